@@ -0,0 +1,66 @@
+/* Dicto
+ * batch_scorer.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+typedef unsigned char UCHAR;
+
+// BatchScorer
+// Collects candidate words and computes their Levenshtein distance to one
+// query a batch at a time. Candidates are stored transposed (one row per
+// character position, one column per candidate) so the DP runs across
+// candidates in SIMD lanes: 32 lanes with AVX2, 16 with SSE2, or a plain
+// loop elsewhere. The implementation is picked at runtime from the CPU.
+class BatchScorer {
+ public:
+  static const int kLanes = 32;         // candidates per batch
+  static const int kMaxWordLen = 32;    // longest candidate we batch
+  static const int kMaxQueryLen = 200;  // keeps 8-bit lanes from saturating
+
+  BatchScorer(const char *query);
+  ~BatchScorer() {};
+  bool Add(const std::string &candidate);
+  bool IsFull() const { return count_ == kLanes; }
+  bool IsEmpty() const { return count_ == 0; }
+  int GetCount() const { return count_; }
+  const std::string & GetCandidate(int lane) const { return words_[ lane ]; }
+  void Score(int *scores);
+  void Clear();
+  static const char *GetImplementation();
+  static bool SetImplementation(const char *name);
+
+ protected:
+  // member variables
+  const UCHAR * query_;
+  int           query_len_;
+  int           count_;
+  int           max_len_;
+  UCHAR         cols_[ kMaxWordLen ][ kLanes ];  // transposed candidates
+  UCHAR         lens_[ kLanes ];
+  std::string   words_[ kLanes ];
+};
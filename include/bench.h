@@ -0,0 +1,51 @@
+/* Dicto
+ * bench.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "ternary_tree.h"
+
+// PerfCounter
+// One hardware event counted for the calling thread through
+// perf_event_open(2). Opening fails quietly where the kernel or the
+// sandbox doesn't allow it; IsOpen() tells.
+class PerfCounter {
+ public:
+  PerfCounter(uint32_t type, uint64_t config);
+  ~PerfCounter();
+  bool IsOpen() { return fd_ >= 0; }
+  void Start();
+  uint64_t Stop();
+ protected:
+  int fd_;
+};
+
+// RunBenchmark
+// Time exact lookups of the tree's own words in shuffled order and of
+// misspelled copies, then fuzzy lookups of the misspellings; print the
+// rate and per-lookup cache and TLB misses. Run it with
+// different -l/-r/-c settings to compare layouts.
+void RunBenchmark(TernaryTree *pTree, char model, uint64_t lookups);
@@ -0,0 +1,77 @@
+/* Dicto
+ * bloom_filter.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// BloomFilter
+// Blocked Bloom filter over 64-bit key hashes: each key sets its bits in a
+// single 64-byte block, so a query costs one cache miss. It answers
+// "definitely absent" or "maybe present"; a maybe must be confirmed
+// against the tree.
+//
+// Keys are built incrementally with Step(), FNV-1a over the key bytes, so
+// hashing a word yields the hash of every prefix on the way. WordKey()
+// turns a prefix hash into the key for the whole word.
+class BloomFilter {
+ public:
+  BloomFilter(size_t items, double fp_rate);
+  ~BloomFilter() {};
+  void Add(uint64_t key);
+  bool MayContain(uint64_t key) const;
+  size_t GetBits() const { return blocks_.size() * 64; }
+  int GetHashCount() const { return hashes_; }
+  size_t GetCount() const { return count_; }
+
+  static uint64_t Start() { return 14695981039346656037ull; }
+  static uint64_t Step(uint64_t state, unsigned char c) {
+    return (state ^ c) * 1099511628211ull;
+  }
+  // A NUL can't occur inside a word, so it marks word keys
+  static uint64_t WordKey(uint64_t state) { return Step(state, 0); }
+  static uint64_t WordKey(const char *word) {
+    uint64_t state = Start();
+    while (*word)
+      state = Step(state, (unsigned char) *word++);
+    return WordKey(state);
+  }
+
+ protected:
+  static const int kBlockWords = 8;       // 512-bit blocks
+
+  // First word of the block picked by the high half of a mixed hash
+  size_t BlockIndex(uint64_t hash) const {
+    return (size_t) (((hash >> 32) * block_count_) >> 32) * kBlockWords;
+  }
+
+  // member variables
+  std::vector< uint64_t > blocks_;
+  size_t block_count_;
+  int hashes_;
+  size_t count_;
+};
@@ -0,0 +1,51 @@
+/* Dicto
+ * case_fold.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// CaseFolder
+// Unicode simple case folding over UTF-8. Dictionary keys and queries are
+// folded once, up front, so the tree compares plain bytes; no per-node
+// locale calls. Folding covers Basic Latin through Latin Extended-B,
+// Greek and Coptic, Cyrillic and its supplement, Armenian, Georgian,
+// Latin Extended Additional, letterlike symbols, number forms, enclosed
+// letters and fullwidth Latin. Other code points (Greek Extended and the
+// later Latin blocks among them), and bytes that aren't valid UTF-8, pass
+// through unchanged.
+//
+// Folded UTF-8 still sorts in code point order, so byte-wise ordering in
+// the tree is the same as ordering by folded code points.
+class CaseFolder {
+ public:
+  static const char *Fold(const char *word, std::string *buffer);
+  static uint32_t FoldCodepoint(uint32_t cp);
+  static bool Less(const std::string &a, const std::string &b);
+ protected:
+  static int Decode(const unsigned char *p, uint32_t *cp);
+  static void Encode(uint32_t cp, std::string *out);
+};
@@ -0,0 +1,76 @@
+/* Dicto
+ * deletion_index.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// DeletionIndex
+// Symmetric-deletion ("SymSpell") index for small edit distances.
+// Every dictionary word contributes the variants obtained by deleting up
+// to max_distance characters from its first prefix_len characters. A query
+// generates the same variants; any word sharing a variant is a candidate
+// that the caller verifies with a real distance calculation.
+//
+// Variants are stored as 32-bit hashes in one flat sorted array, so a
+// collision only costs an extra verification. Memory is tuned with
+// max_distance and prefix_len.
+class DeletionIndex {
+ public:
+  DeletionIndex(int max_distance = 2, int prefix_len = 7);
+  ~DeletionIndex() {};
+  void Add(const char *word);
+  void Lookup(const char *word, int max_distance, std::vector< uint32_t > *ids);
+  const std::string & GetWord(uint32_t id) const { return words_[ id ]; }
+  int GetMaxDistance() const { return max_distance_; }
+  int GetPrefixLength() const { return prefix_len_; }
+  size_t GetWordCount() const { return words_.size(); }
+  size_t GetEntryCount() const { return entries_.size(); }
+  void Finalize();
+ protected:
+  void GenerateDeletes(
+    const std::string &word,
+    int max_distance,
+    std::vector< uint32_t > *hashes);
+  static uint32_t Hash(const char *s, size_t len);
+
+  // Variant hash / word id pair; entries_ is sorted by hash
+  struct Entry {
+    uint32_t hash;
+    uint32_t id;
+    bool operator<(const Entry &rhs) const {
+      return hash < rhs.hash || (hash == rhs.hash && id < rhs.id);
+    }
+  };
+
+  // member variables
+  int max_distance_;
+  int prefix_len_;
+  bool sorted_;
+  std::vector< std::string > words_;
+  std::vector< Entry > entries_;
+};
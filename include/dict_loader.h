@@ -0,0 +1,103 @@
+/* Dicto
+ * dict_loader.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "ternary_tree.h"
+
+// DictionaryLoader
+// Reads a word-per-line text dictionary. The file is mapped and split in
+// one newline scan; CRLF endings, blank lines and duplicate words are
+// handled, and the input need not be sorted. Words are sorted in memory,
+// or through sorted runs in temporary files when the file is larger than
+// the memory budget, then inserted median first so the tree comes out
+// balanced whatever the input order.
+//
+// Lines that can't be words are skipped and reported as "path:line:
+// reason"; Load() itself fails only when the file can't be read.
+class DictionaryLoader {
+ public:
+  static const size_t kMaxWordLen = 255;
+  static const size_t kMaxReported = 20;  // skipped lines kept in GetErrors()
+  static const size_t kMaxRuns = 64;      // open temporary files while sorting
+
+  DictionaryLoader();
+  ~DictionaryLoader();
+  bool Load(const char *path);
+  void Build(TernaryTree *pTree);
+  void SetMemoryBudget(size_t bytes) { budget_ = bytes; }
+
+  size_t GetWordCount() { return words_.size(); }
+  std::string GetWord(size_t i) { return std::string(words_[ i ].text, words_[ i ].len); }
+  size_t GetLineCount() { return lines_; }
+  size_t GetBlankCount() { return blanks_; }
+  size_t GetDuplicateCount() { return duplicates_; }
+  size_t GetSkippedCount() { return skipped_; }
+  bool WasSorted() { return sorted_; }
+  bool WasExternal() { return external_; }
+  const std::string &GetError() { return error_; }
+  const std::vector< std::string > &GetErrors() { return errors_; }
+
+ protected:
+  // A word inside a mapping; not null-terminated
+  struct Word {
+    const char *text;
+    uint32_t len;
+  };
+
+  bool Map(const char *path, int fd, const char **pData, size_t *pSize);
+  void Unmap();
+  bool NextLine(
+    const char **pCursor,
+    const char *end,
+    const char *path,
+    Word *word);
+  void Skip(const char *path, const char *reason);
+  void SortUnique(std::vector< Word > *words);
+  bool ExternalSort(const char *data, size_t size, const char *path);
+  bool WriteRun(std::vector< Word > *words, std::vector< FILE * > *runs);
+  bool MergeRuns(std::vector< FILE * > &runs, FILE *out);
+  bool CollapseRuns(std::vector< FILE * > *runs);
+  void BuildRange(TernaryTree *pTree, size_t lo, size_t hi, char *buf);
+  static bool Less(const Word &a, const Word &b);
+  static int Compare(const char *a, size_t a_len, const char *b, size_t b_len);
+
+  // member variables
+  size_t budget_;                   // bytes of words to sort in memory
+  std::vector< Word > words_;       // sorted, unique
+  std::vector< std::pair< const char *, size_t > > maps_;
+  size_t lines_;
+  size_t blanks_;
+  size_t duplicates_;
+  size_t skipped_;
+  bool sorted_;                     // input was already in order
+  bool external_;                   // sorted through temporary files
+  std::string error_;
+  std::vector< std::string > errors_;
+};
@@ -0,0 +1,154 @@
+/* Dicto
+ * edit_cost.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+typedef unsigned char UCHAR;
+
+// Edit cost models
+// Each model is a struct of static members handed to CalcDistance and
+// TernaryTree::FuzzyFind as a template parameter, so the costs inline
+// into the DP loop with no virtual dispatch.
+//
+//  kUnit       cost of one full edit; max distances are given in full
+//              edits and scaled by kUnit
+//  kMinEdit    cheapest single edit, bounds the number of edits a
+//              distance can hide (used to pick the deletion index)
+//  kMinIndel   cheapest insert/delete, bounds how far a candidate's
+//              length may stray from the query
+//  kTranspose  adjacent transpositions are a single edit
+//  kBatchable  BatchScorer computes exactly this model
+
+// UnitCost
+// Classic Levenshtein: every insert, delete and substitution costs 1.
+struct UnitCost {
+  static const int kUnit = 1;
+  static const int kMinEdit = 1;
+  static const int kMinIndel = 1;
+  static const bool kTranspose = false;
+  static const bool kBatchable = true;
+  static int Substitute(UCHAR a, UCHAR b) { return a == b ? 0 : 1; }
+  static int Insert(UCHAR) { return 1; }
+  static int Delete(UCHAR) { return 1; }
+  static int Transpose(UCHAR, UCHAR) { return 1; }
+};
+
+// DamerauCost
+// Optimal string alignment: unit costs plus adjacent transpositions.
+struct DamerauCost : public UnitCost {
+  static const bool kTranspose = true;
+  static const bool kBatchable = false;
+};
+
+// CaseFoldCost
+// Unit costs, but letters differing only in case match.
+struct CaseFoldCost : public UnitCost {
+  static const bool kBatchable = false;
+  static int Substitute(UCHAR a, UCHAR b) {
+    return tolower(a) == tolower(b) ? 0 : 1;
+  }
+};
+
+// KeyboardCost
+// Weighted by QWERTY key distance, in half edits: substituting a key for
+// one of its neighbours (or for itself in the other case) costs 1, any
+// other edit costs 2. Transpositions are also a single full edit.
+struct KeyboardCost {
+  static const int kUnit = 2;
+  static const int kMinEdit = 1;
+  static const int kMinIndel = 2;
+  static const bool kTranspose = true;
+  static const bool kBatchable = false;
+  static int Substitute(UCHAR a, UCHAR b) {
+    if (a == b)
+      return 0;
+    int ra = row_[ a ], rb = row_[ b ];
+    if (ra < 0 || rb < 0)
+      return 2;
+    int dr = ra - rb, dc = col_[ a ] - col_[ b ];
+    if (!dr)
+      return (dc >= -2 && dc <= 2) ? 1 : 2;
+    return (dr >= -1 && dr <= 1 && dc >= -1 && dc <= 1) ? 1 : 2;
+  }
+  static int Insert(UCHAR) { return 2; }
+  static int Delete(UCHAR) { return 2; }
+  static int Transpose(UCHAR, UCHAR) { return 2; }
+
+  // Key row and half-key column per character, -1 when not a letter key;
+  // filled in at startup (edit_cost.cc)
+  static signed char row_[ 256 ];
+  static signed char col_[ 256 ];
+};
+
+// CalcDistance
+// Weighted edit distance between two strings under a cost model. With
+// UnitCost this is the Levenshtein distance; models with kTranspose set
+// get optimal string alignment (restricted Damerau) distance.
+//
+// @In:     s1 string #1
+//          s2 string #2
+// @Out:    distance in model units, -1 if either string is missing
+template <class Model>
+int CalcDistance(const char *s1, const char *s2)
+{
+  if (!s1 || !s2)
+    return -1;
+
+  const UCHAR *a = (const UCHAR *) s1;
+  const UCHAR *b = (const UCHAR *) s2;
+  int len1 = (int) strlen(s1);
+  int len2 = (int) strlen(s2);
+  int rows[ 3 ][ len2 + 1 ];
+  int *prev2 = rows[ 0 ], *prev = rows[ 1 ], *cur = rows[ 2 ];
+  int i, j;
+
+  prev[ 0 ] = 0;
+  for (j = 1; j <= len2; j++)
+    prev[ j ] = prev[ j - 1 ] + Model::Insert(b[ j - 1 ]);
+
+  for (i = 1; i <= len1; i++) {
+    cur[ 0 ] = prev[ 0 ] + Model::Delete(a[ i - 1 ]);
+    for (j = 1; j <= len2; j++) {
+      int v = std::min(prev[ j ] + Model::Delete(a[ i - 1 ]),
+        cur[ j - 1 ] + Model::Insert(b[ j - 1 ]));
+      v = std::min(v, prev[ j - 1 ] + Model::Substitute(a[ i - 1 ], b[ j - 1 ]));
+      if (Model::kTranspose && i > 1 && j > 1 &&
+          !Model::Substitute(a[ i - 1 ], b[ j - 2 ]) &&
+          !Model::Substitute(a[ i - 2 ], b[ j - 1 ])) {
+        v = std::min(v, prev2[ j - 2 ] + Model::Transpose(a[ i - 2 ], a[ i - 1 ]));
+      }
+      cur[ j ] = v;
+    }
+    int *tmp = prev2;
+    prev2 = prev;
+    prev = cur;
+    cur = tmp;
+  }
+  return prev[ len2 ];
+}
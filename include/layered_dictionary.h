@@ -0,0 +1,94 @@
+/* Dicto
+ * layered_dictionary.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "ternary_tree.h"
+
+// LayeredDictionary
+// A per-tenant dictionary layered over a shared base tree. The tenant's
+// own words go in a small tree of additions, and base words the tenant
+// doesn't want go in a tree of suppressions; the base is never copied or
+// modified, so any number of tenants can share one loaded base and each
+// costs only its deltas.
+//
+// Lookups merge the layers: a word is present if it was added, or if it
+// is in the base and not suppressed. Changes apply in order, so a later
+// Add undoes an earlier Suppress and vice versa.
+//
+// Fuzzy lookups search each layer and merge the results into what one
+// tree holding the tenant's words would return. The layers walk from the
+// stem that tree would pick, and share one query budget.
+//
+// Queries don't modify anything and may run concurrently with each other
+// (and with other tenants' queries on the same base); Add/Suppress may not.
+class LayeredDictionary {
+ public:
+  LayeredDictionary(TernaryTree *pBase);
+  ~LayeredDictionary() {};
+  void Add(const char *word);
+  void Suppress(const char *word);
+  bool Load(const char *path);
+  void Finalize();
+  bool Find(const char *word);
+  size_t Complete(
+    const char *prefix,
+    std::vector< std::string > *words,
+    size_t limit);
+  void FuzzyFindWithModel(
+    char model,
+    const char *word,
+    std::map< int, std::string > *words,
+    QueryStatus *pStatus = NULL,
+    const QueryBudget *pBudget = NULL);
+  TernaryTree *GetBase() { return base_; }
+  size_t GetAddedCount() { return added_; }
+  size_t GetSuppressedCount() { return suppressed_; }
+  size_t GetNodeCount() { return adds_.GetNodeCount() + removes_.GetNodeCount(); }
+ protected:
+  size_t GetStem(const char *word);
+  static bool GetBudgetLeft(
+    const QueryBudget &budget,
+    const QueryStatus &status,
+    ExtrapolateContext::Clock::time_point start,
+    QueryBudget *pLeft);
+  static bool Unset(TernaryTree *pTree, const char *word);
+  static void MergeScored(
+    const std::map< int, std::string > &from,
+    TernaryTree *pFilter,
+    bool keep,
+    std::map< int, int > *tie_breaker_lookup,
+    std::map< int, std::string > *words);
+
+  // member variables
+  TernaryTree *base_;       // shared, never modified
+  TernaryTree adds_;        // words the base lacks
+  TernaryTree removes_;     // base words hidden from this tenant
+  size_t added_;            // words live in adds_
+  size_t suppressed_;       // words live in removes_
+};
@@ -0,0 +1,60 @@
+/* Dicto
+ * loadgen.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// LoadGenerator
+// Drives a QueryServer with words drawn from the dictionary. Each
+// connection runs on its own thread and keeps `depth` requests in flight;
+// the op mix is a string of op letters picked uniformly, so "FFFZC" is
+// 60% exact, 20% fuzzy and 20% completion. Fuzzy queries get one
+// character replaced so they exercise the edit distance path.
+class LoadGenerator {
+ public:
+  LoadGenerator(const std::vector< std::string > &words);
+  bool Run(
+    const char *address,
+    int connections,
+    int depth,
+    uint64_t requests,
+    const char *ops);
+ protected:
+  void ConnectionLoop(
+    int index,
+    int fd,
+    uint64_t count,
+    int depth,
+    const char *ops);
+  void MakeRequest(uint64_t *rng, const char *ops, std::string *out);
+
+  // member variables
+  const std::vector< std::string > &words_;
+  std::vector< std::vector< uint32_t > > latencies_;  // usec, per connection
+  std::vector< int > errors_;                         // per connection
+};
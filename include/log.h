@@ -26,6 +26,7 @@
 #pragma once
 
 enum _LOG_LEVEL {
+  LOG_SILENT = -1,    // suppress even LOG_NONE output (server mode)
   LOG_NONE = 0,
   LOG_INFO,
   LOG_DEBUG
@@ -0,0 +1,71 @@
+/* Dicto
+ * replica.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include "ternary_tree.h"
+
+// ReplicaSet
+// Read-only copies of a loaded tree, one per NUMA node, so queries walk
+// node-local memory. Each copy is built by a thread bound to its node's
+// CPUs; first-touch allocation then puts its pages on that node. Local()
+// routes by the CPU the caller is running on.
+//
+// On a single-node machine, or with replication off, the original tree
+// serves everything and nothing is copied.
+class ReplicaSet {
+ public:
+  ReplicaSet(TernaryTree *pTree, bool replicate);
+  ~ReplicaSet();
+  TernaryTree *Local(int *pReplica = NULL);
+  int GetReplicaCount() { return (int) replicas_.size(); }
+  int GetNumaNodeCount() { return numa_nodes_; }
+  uint64_t GetServed(int replica) { return counters_[ replica ].served; }
+  void PrintStats(std::ostream &out);
+ protected:
+  static bool ParseCpuList(const char *text, std::vector< int > *cpus);
+  static bool ReadFile(const char *path, std::string *text);
+  static void BuildReplica(
+    TernaryTree *pSource,
+    TernaryTree *pReplica,
+    const std::vector< int > &cpus);
+
+  // Per-replica query count, padded to its own cache line
+  struct Counter {
+    std::atomic< uint64_t > served;
+    char pad[ 64 - sizeof(std::atomic< uint64_t >) ];
+  };
+
+  // member variables
+  TernaryTree *source_;
+  int numa_nodes_;
+  std::vector< TernaryTree * > replicas_;   // [0] is source_ when not replicated
+  std::vector< int > cpu_replica_;          // replica for each CPU
+  Counter *counters_;
+};
@@ -0,0 +1,128 @@
+/* Dicto
+ * server.h
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "replica.h"
+
+// QueryServer
+// Serves lookups against one shared, fully loaded tree (or its per-NUMA-node
+// replicas) over a Unix-domain socket or a loopback TCP port. A single epoll thread owns the sockets;
+// parsed requests go to a pool of worker threads and the replies come
+// back through an eventfd.
+//
+// Protocol: one request per line, "<op> <word>\n", where op is
+//   F   exact lookup          reply "1" or "0"
+//   Z   fuzzy lookup          reply "<n>", then " <score>:<word>" n times;
+//                             "<n>+" when the query budget cut it short
+//   C   prefix completion     reply "<n>", then " <word>" n times
+// Malformed requests get "E <reason>". Clients may pipeline any number of
+// requests; each connection gets its replies in request order.
+//
+// Addresses: anything containing a '/' is a Unix socket path, otherwise
+// "[127.0.0.1:]port" on the loopback interface.
+class QueryServer {
+ public:
+  static const size_t kMaxLine = 256;         // longest request line
+  static const size_t kMaxInFlight = 4096;    // per connection, then stop reading
+  static const size_t kMaxCompletions = 64;
+
+  QueryServer(ReplicaSet *pReplicas, int threads, char model);
+  ~QueryServer();
+  bool Run(const char *address);
+  void Stop();
+  uint64_t GetServed() const { return served_; }
+  uint64_t GetConnections() const { return connections_; }
+
+  static int Listen(const char *address);
+  static int Connect(const char *address);
+
+ protected:
+  struct Job {
+    uint64_t conn;
+    uint64_t seq;
+    char op;
+    std::string word;
+  };
+
+  struct Reply {
+    uint64_t conn;
+    uint64_t seq;
+    std::string text;
+  };
+
+  struct Connection {
+    int fd;
+    uint64_t id;
+    std::string in;
+    std::string out;
+    uint64_t next_seq;        // sequence number of the next request read
+    uint64_t next_reply;      // sequence number of the next reply to send
+    std::map< uint64_t, std::string > ready;  // replies waiting their turn
+    bool closing;             // peer closed; drop after the last reply
+    uint32_t events;          // epoll events currently registered
+  };
+
+  void WorkerLoop();
+  void Execute(const Job &job, std::string *reply);
+  void Accept();
+  void ReadFrom(Connection *conn);
+  void ParseRequests(Connection *conn, std::vector< Job > *jobs);
+  void WriteTo(Connection *conn);
+  void DrainReplies();
+  void UpdateEvents(Connection *conn);
+  void Close(Connection *conn);
+
+  // member variables
+  ReplicaSet *replicas_;
+  int threads_;
+  char model_;
+  int epoll_fd_;
+  int listen_fd_;
+  int wake_fd_;               // eventfd: replies ready or stop requested
+  std::string unix_path_;
+  std::atomic< bool > running_;
+  uint64_t next_id_;
+  std::map< uint64_t, Connection * > conns_;
+
+  std::mutex job_lock_;
+  std::condition_variable job_ready_;
+  std::deque< Job > jobs_;
+  std::mutex reply_lock_;
+  std::vector< Reply > replies_;
+  std::vector< std::thread > workers_;
+
+  std::atomic< uint64_t > served_;
+  uint64_t connections_;
+};
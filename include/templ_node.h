@@ -51,23 +51,36 @@ template <typename kt_, class nc_> class TemplNode {
   void SetCenter( nc_ *pNode ) { c_ = pNode; }
   nc_ * GetCenter() { return c_; }
   void SetTerminator() { terminator_ = 1; }
+  void ClearTerminator() { terminator_ = 0; }
   bool GetTerminator() { return terminator_ ? true : false; }
-  void SetUpper() { upper_ = 1; }
-  bool GetUpper() { return upper_ ? true : false; }
+  void SetCased() { cased_ = 1; }
+  bool GetCased() { return cased_ ? true : false; }
+  int GetTailLength() { return tail_len_; }
+  const kt_ * GetTail() { return tail_; }
+  void SetTailLength( int len ) { tail_len_ = len; }
 
   // clear out node.
   void clear() {
     parent_ = l_ = c_ = r_ = nullptr;
     terminator_ = 0;
-    upper_ = 0;
+    cased_ = 0;
+    tail_len_ = 0;
   }
 
+  // Path compression: a node may carry a run of keys that follow key_
+  // with no siblings in between. l_/r_ compare against key_ only; the
+  // terminator and c_ belong to the last key of the run. kMaxTail is
+  // sized so the node stays 40 bytes with 8-bit keys.
+  static const int kMaxTail = 6;
+
   // member variables
   nc_ *       parent_;    // parent
   nc_ *       l_;         // left (lo kid/less than)
   nc_ *       c_;         // center (equal kid)
   nc_ *       r_;         // right (hi kid/greater than)
   kt_         key_;       // key
-  unsigned    terminator_: 1;
-  unsigned    upper_: 1;
+  kt_         tail_[ kMaxTail ];  // compressed run following key_
+  unsigned char tail_len_: 3;
+  unsigned char terminator_: 1;
+  unsigned char cased_: 1;    // word ending here has surface forms on the side
 };
@@ -30,7 +30,18 @@
 #include <queue>
 #include <deque>
 #include <stack>
+#include <unordered_map>
+#include <vector>
+#include <string.h>
+#include <limits.h>
+#include <atomic>
+#include <chrono>
 #include "templ_node.h"
+#include "batch_scorer.h"
+#include "edit_cost.h"
+#include "deletion_index.h"
+#include "bloom_filter.h"
+#include "case_fold.h"
 
 typedef unsigned char UCHAR;
 
@@ -38,66 +49,325 @@ typedef unsigned char UCHAR;
 #define INFO
 
 // TNode
-// This is the instantiable class from my TemplNode template
+// This is the instantiable class from my TemplNode template. Keys are
+// bytes of case-folded UTF-8 (see CaseFolder); the tree never folds them
+// itself.
 class TNode : public TemplNode <UCHAR, TNode> {
  public:
   TNode() {};
   TNode(UCHAR key) : TemplNode <UCHAR, TNode> (key) { };
   ~TNode() {};
-  void SetKey(UCHAR key)
+  void SetTail(const char *run, int len)
   {
-      if(isupper(key) )
-      {
-          SetUpper();
-      }
-      key_ = (UCHAR) tolower(key);
+      memcpy(tail_, run, len);
+      tail_len_ = len;
   }
 };
 
+// LAYOUT selects the node order Relayout packs subtrees in.
+enum LAYOUT
+{
+  LAYOUT_NONE = 0,  // leave nodes where Insert allocated them
+  LAYOUT_DFS,       // depth-first, center child right after its node
+  LAYOUT_VEB,       // van Emde Boas: recursively split by height
+};
+
+// HUGE_PAGES selects the backing for the Relayout arena.
+enum HUGE_PAGES
+{
+  HUGE_PAGES_NONE = 0,      // plain malloc
+  HUGE_PAGES_TRANSPARENT,   // 2MB-aligned mapping with MADV_HUGEPAGE
+  HUGE_PAGES_EXPLICIT,      // MAP_HUGETLB, else transparent
+};
+
+// QueryBudget
+// Work limits for one fuzzy lookup; 0 == unlimited. A query that hits one
+// stops and returns the best words it has scored so far.
+struct QueryBudget {
+  QueryBudget() {
+    max_visits = 0;
+    max_candidates = 0;
+    deadline_us = 0;
+  }
+  size_t max_visits;        // tree nodes entered
+  size_t max_candidates;    // words scored
+  uint64_t deadline_us;     // wall-clock time from the start of the query
+};
+
+// QueryStatus
+// What a fuzzy lookup spent, and whether a budget limit cut it short.
+struct QueryStatus {
+  QueryStatus() {
+    visits = 0;
+    candidates = 0;
+    partial = false;
+  }
+  size_t visits;
+  size_t candidates;
+  bool partial;
+};
+
+// ExtrapolateContext
+// Per-query state threaded through the stem search and Extrapolate: the
+// result map, the candidates waiting to be batch scored, the length bound
+// and the work budget.
+struct ExtrapolateContext {
+  typedef std::chrono::steady_clock Clock;
+
+  ExtrapolateContext(
+    const char *pStem,
+    const char *pWord,
+    int max_diff,
+    int max_depth,
+    bool batching,
+    std::map< int, std::string > *pWords,
+    const QueryBudget &budget) : batch(pWord), budget(budget) {
+    stem = pStem;
+    word = pWord;
+    words = pWords;
+    this->max_diff = max_diff;
+    this->max_depth = max_depth;
+    this->batching = batching;
+    stopped = false;
+    if (budget.deadline_us)
+      deadline = Clock::now() + std::chrono::microseconds(budget.deadline_us);
+  }
+
+  // Count a node visit; false once the budget is spent. The clock is
+  // read every 64 visits.
+  bool Visit() {
+    if (stopped)
+      return false;
+    status.visits++;
+    if ((budget.max_visits && status.visits > budget.max_visits) ||
+        (budget.deadline_us && !(status.visits & 63) && Clock::now() >= deadline))
+      stopped = true;
+    return !stopped;
+  }
+
+  // Count a word about to be scored; false, refusing it, once the
+  // candidate budget is spent. A query with exactly the budget's worth
+  // of candidates is therefore not partial.
+  bool Candidate() {
+    if (stopped)
+      return false;
+    if (budget.max_candidates && status.candidates >= budget.max_candidates) {
+      stopped = true;
+      return false;
+    }
+    status.candidates++;
+    return true;
+  }
+
+  std::map< int, std::string > *words;
+  std::map< int, int > tie_breaker_lookup;
+  BatchScorer batch;
+  const char *stem;
+  const char *word;
+  int max_diff;     // in cost model units, 0 == unbounded
+  int max_depth;    // keys below the stem still within max_diff
+  bool batching;    // the cost model can use the batch scorer
+  const QueryBudget &budget;
+  Clock::time_point deadline;
+  QueryStatus status;
+  bool stopped;     // budget spent; unwind without visiting more nodes
+};
+
 // TernaryTree
 // This class is the tree itself. It manages a ternary search tree of TNodes
 // This is a dictionary and allows us quick word lookup
 // with a yes/no response.
+//
+// The fuzzy lookups take an edit cost model (see edit_cost.h) as a
+// template parameter. They are instantiated in ternary_tree.cc for the
+// stock models; a new model needs an INSTANTIATE_COST_MODEL line there.
 class TernaryTree {
  public:
   TernaryTree() {
     tie_hwm_ = 0;
     max_diff_ = 10;
+    deletion_index_ = NULL;
+    bloom_ = NULL;
+    root_ = NULL;
+    root_levels_ = 0;
+    compress_ = true;
+    node_count_ = 0;
+    arena_ = NULL;
+    arena_size_ = 0;
+    arena_bytes_ = 0;
+    huge_pages_ = HUGE_PAGES_NONE;
+    memset(root_table_, 0, sizeof(root_table_));
+    memset(root_table2_, 0, sizeof(root_table2_));
   };
-  ~TernaryTree() {};
+  ~TernaryTree();
   TNode * Insert(const char *pWord, TNode **ppNode = NULL);
-  bool Find(const char *pWord, TNode *pParent, TNode ** ppTerminal = NULL);
+  bool Find(
+    const char *pWord,
+    TNode *pParent,
+    TNode ** ppTerminal = NULL,
+    int *pRunOffset = NULL);
+  template <class Model = UnitCost>
   void FuzzyFind(
     const char *pWord,
     TNode *pParent,
-    std::map< int, std::string > *pWords);
+    std::map< int, std::string > *pWords,
+    QueryStatus *pStatus = NULL,
+    const QueryBudget *pBudget = NULL,
+    size_t stem_len = SIZE_MAX);
+  void FuzzyFindWithModel(
+    char model,
+    const char *pWord,
+    TNode *pParent,
+    std::map< int, std::string > *pWords,
+    QueryStatus *pStatus = NULL,
+    const QueryBudget *pBudget = NULL,
+    size_t stem_len = SIZE_MAX);
+  size_t Complete(
+    const char *pPrefix,
+    TNode *pParent,
+    std::vector< std::string > *pWords,
+    size_t limit);
+  template <class Model = UnitCost>
   bool ExtrapolateAll(
     TNode *pNode,
     std::map< int, std::string > *pWords,
     std::deque< UCHAR > *accum,
     const char *pStem,
-    const char *pWord
+    const char *pWord,
+    bool score_node = false,
+    QueryStatus *pStatus = NULL,
+    const QueryBudget *pBudget = NULL
     );
+  template <class Model = UnitCost>
   bool Extrapolate(
     TNode *pRoot,
     TNode *pNode,
-    std::map< int, std::string > *pWords,
     std::deque< UCHAR > *accum,
-    const char *pStem,
-    const char *pWord,
-    std::map< int, int > *tie_breaker_lookup,
-    const int max_diff = 0,
+    ExtrapolateContext *ctx,
     int depth = 0);
 
- int GetMaxTies() { return tie_hwm_; }
+ int GetMaxTies() { return tie_hwm_.load(); }
  void ClearMaxTies() { tie_hwm_ = 0; }
  void SetMaxDifference(int max) { max_diff_ = max; }
  int GetMaxDifference() { return max_diff_; }
+ void SetQueryBudget(const QueryBudget &budget) { budget_ = budget; }
+ const QueryBudget &GetQueryBudget() { return budget_; }
+ void EnableDeletionIndex(int max_distance, int prefix_len);
+ DeletionIndex *GetDeletionIndex() { return deletion_index_; }
+ void EnableBloomFilter(double fp_rate);
+ BloomFilter *GetBloomFilter() { return bloom_; }
+ TNode *GetRoot() { return root_; }
+ void EnableRootTable(int levels);
+ int GetRootTableLevels() { return root_levels_; }
+ void SetPathCompression(bool compress) { compress_ = compress; }
+ size_t GetNodeCount() { return node_count_; }
+ static const int kHotLevels = 8;
+ void Relayout(LAYOUT layout = LAYOUT_DFS, int hot_levels = kHotLevels);
+ void CopyFrom(TernaryTree &source);
+ void SetHugePages(HUGE_PAGES mode) { huge_pages_ = mode; }
+ HUGE_PAGES GetHugePages() { return huge_pages_; }
+ const TNode *GetArena() { return arena_; }
+ size_t GetArenaSize() { return arena_size_; }
+ size_t GetCasedCount() { return surface_.size(); }
  protected:
+  bool FindKey(
+    const char *pWord,
+    TNode *pParent,
+    TNode ** ppTerminal,
+    int *pRunOffset,
+    ExtrapolateContext *ctx = NULL);
+  void AddSurfaceForm(const char *pKey, const char *pWord, bool existed);
+  void AddSurfaceForms(
+    TNode *pNode,
+    const std::string &key,
+    std::vector< std::string > *pWords,
+    size_t limit);
+  TNode *InsertNode(const char *pWord, TNode **ppNode);
+  TNode *InsertRooted(const char *pWord);
+  TNode *InsertKey(char key, TNode **ppNode, TNode *pParent);
+  bool FindRooted(
+    const char *pWord,
+    TNode ** ppTerminal,
+    int *pRunOffset,
+    ExtrapolateContext *ctx);
+  void SplitRun(TNode *pNode, int keep);
+  void IndexRootLevel(TNode *pNode);
+  void CollectWords(
+    TNode *pNode,
+    std::string *prefix,
+    std::vector< std::string > *pWords,
+    size_t limit);
+  template <class Model>
+  void ExtrapolateStem(
+    TNode *pNode,
+    std::deque< UCHAR > *accum,
+    bool score_node,
+    ExtrapolateContext *ctx);
+  void ScoreBatch(ExtrapolateContext *ctx);
+  template <class Model>
+  void IndexFind(
+    const char *pWord,
+    std::map< int, std::string > *pWords,
+    QueryStatus *pStatus,
+    const QueryBudget &limits);
+  void AddScoredWord(
+    std::map< int, std::string > *pWords,
+    std::map< int, int > *tie_breaker_lookup,
+    int score,
+    const std::string &word);
   TNode *AllocNode(char key);
+  size_t CountBloomKeys(TNode *pNode);
+  void AddToBloom(TNode *pNode, uint64_t state);
+  size_t GetBloomPrefix(const char *pWord);
+  void GetLayoutOrder(
+    LAYOUT layout,
+    int hot_levels,
+    std::vector< TNode * > *order);
+  void CopyNodes(const std::vector< TNode * > &order, TernaryTree &source);
+  TNode *AllocArena(size_t count, size_t *bytes);
+  static void FreeArena(TNode *arena, size_t bytes);
+  void LayoutDfs(TNode *pNode, std::vector< TNode * > *order);
+  void LayoutVeb(TNode *pNode, int height, std::vector< TNode * > *order);
+  static int GetHeight(TNode *pNode);
+  static void CollectLevel(
+    TNode *pNode,
+    int depth,
+    std::vector< TNode * > *nodes);
   int CalcLevenshtein(const char *s1, const char *s2);
 
   // member variables
-  int tie_hwm_;
+  std::atomic< int > tie_hwm_;     // updated by concurrent queries
   int max_diff_;
+  QueryBudget budget_;              // default for queries that pass none
+  DeletionIndex *deletion_index_;
+
+  // Every prefix and word under root_, case folded. Only consulted for
+  // lookups that start at root_.
+  BloomFilter *bloom_;
+
+  // Surface forms of the words inserted with capitals, keyed by folded
+  // word; the word's terminal node is flagged cased. A folded spelling
+  // inserted as well is listed too, so the list is every form of the word.
+  std::unordered_map< std::string, std::vector< std::string > > surface_;
+
+  // The tree's own root. Insert() without a node pointer builds here, and
+  // Find()/FuzzyFind() starting at it go through the root table.
+  TNode *root_;
+
+  // Hybrid top levels: direct-indexed by the first one or two (folded)
+  // characters. The nodes are still linked as a regular ternary tree; the
+  // tables only short-cut the sibling chains at the top.
+  int root_levels_;                 // 0 == off, 1 or 2
+  TNode *root_table_[ 256 ];        // first-character nodes
+  TNode **root_table2_[ 256 ];      // second-character nodes, per first char
+
+  bool compress_;                   // new branches store runs in one node
+  size_t node_count_;
+
+  // Contiguous node storage written by Relayout. Nodes inserted later are
+  // still allocated one by one.
+  TNode *arena_;
+  size_t arena_size_;               // nodes
+  size_t arena_bytes_;              // mapped length, 0 == malloc'd
+  HUGE_PAGES huge_pages_;
 };
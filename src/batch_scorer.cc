@@ -0,0 +1,325 @@
+/* Dicto
+ * batch_scorer.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <string.h>
+#include <string>
+#include "batch_scorer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_SCORER_X86
+#include <immintrin.h>
+#endif
+
+const int BatchScorer::kLanes;
+const int BatchScorer::kMaxWordLen;
+const int BatchScorer::kMaxQueryLen;
+
+typedef UCHAR BatchCols[ BatchScorer::kMaxWordLen ][ BatchScorer::kLanes ];
+
+// Each kernel fills out[ 0..kLanes ) with the distance between the query
+// and the candidate in that lane. The DP keeps one column per query
+// position and walks candidate positions; a lane's result is captured
+// when the walk reaches that candidate's length.
+typedef void (*ScoreKernel)(
+    const UCHAR *query,
+    int query_len,
+    const BatchCols &cols,
+    const UCHAR *lens,
+    int max_len,
+    UCHAR *out);
+
+// ScoreScalar
+// Portable kernel. Same lane layout as the SIMD kernels.
+static void ScoreScalar(
+    const UCHAR *query,
+    int query_len,
+    const BatchCols &cols,
+    const UCHAR *lens,
+    int max_len,
+    UCHAR *out)
+{
+  const int lanes = BatchScorer::kLanes;
+  UCHAR column[ BatchScorer::kMaxQueryLen + 1 ][ lanes ];
+  UCHAR diag[ lanes ];
+  int i, j, k;
+
+  for (i = 0; i <= query_len; i++)
+    memset(column[ i ], i, lanes);
+  memset(out, query_len, lanes);
+
+  for (j = 1; j <= max_len; j++) {
+    const UCHAR *c = cols[ j - 1 ];
+    memcpy(diag, column[ 0 ], lanes);
+    memset(column[ 0 ], j, lanes);
+    for (i = 1; i <= query_len; i++) {
+      UCHAR q = query[ i - 1 ];
+      for (k = 0; k < lanes; k++) {
+        UCHAR up = column[ i ][ k ];
+        UCHAR v = up + 1;
+        UCHAR left = column[ i - 1 ][ k ] + 1;
+        UCHAR sub = diag[ k ] + (q == c[ k ] ? 0 : 1);
+        if (left < v)
+          v = left;
+        if (sub < v)
+          v = sub;
+        diag[ k ] = up;
+        column[ i ][ k ] = v;
+      }
+    }
+    for (k = 0; k < lanes; k++) {
+      if (lens[ k ] == j)
+        out[ k ] = column[ query_len ][ k ];
+    }
+  }
+}
+
+#if defined(BATCH_SCORER_X86)
+
+// ScoreSse2
+// 16 lanes per pass, two passes per batch.
+__attribute__((target("sse2")))
+static void ScoreSse2(
+    const UCHAR *query,
+    int query_len,
+    const BatchCols &cols,
+    const UCHAR *lens,
+    int max_len,
+    UCHAR *out)
+{
+  __m128i column[ BatchScorer::kMaxQueryLen + 1 ];
+  __m128i q[ BatchScorer::kMaxQueryLen ];
+  const __m128i one = _mm_set1_epi8(1);
+  int i, j, off;
+
+  for (i = 0; i < query_len; i++)
+    q[ i ] = _mm_set1_epi8((char) query[ i ]);
+
+  for (off = 0; off < BatchScorer::kLanes; off += 16) {
+    __m128i len = _mm_loadu_si128((const __m128i *) (lens + off));
+    __m128i result = _mm_set1_epi8((char) query_len);
+    for (i = 0; i <= query_len; i++)
+      column[ i ] = _mm_set1_epi8((char) i);
+
+    for (j = 1; j <= max_len; j++) {
+      __m128i c = _mm_loadu_si128((const __m128i *) &cols[ j - 1 ][ off ]);
+      __m128i diag = column[ 0 ];
+      __m128i left = column[ 0 ] = _mm_set1_epi8((char) j);
+      for (i = 1; i <= query_len; i++) {
+        __m128i up = column[ i ];
+        __m128i cost = _mm_andnot_si128(_mm_cmpeq_epi8(c, q[ i - 1 ]), one);
+        __m128i v = _mm_min_epu8(_mm_adds_epu8(up, one), _mm_adds_epu8(left, one));
+        v = _mm_min_epu8(v, _mm_adds_epu8(diag, cost));
+        column[ i ] = left = v;
+        diag = up;
+      }
+      __m128i done = _mm_cmpeq_epi8(len, _mm_set1_epi8((char) j));
+      result = _mm_or_si128(_mm_and_si128(done, column[ query_len ]),
+        _mm_andnot_si128(done, result));
+    }
+    _mm_storeu_si128((__m128i *) (out + off), result);
+  }
+}
+
+// ScoreAvx2
+// All 32 lanes in one pass.
+__attribute__((target("avx2")))
+static void ScoreAvx2(
+    const UCHAR *query,
+    int query_len,
+    const BatchCols &cols,
+    const UCHAR *lens,
+    int max_len,
+    UCHAR *out)
+{
+  __m256i column[ BatchScorer::kMaxQueryLen + 1 ];
+  __m256i q[ BatchScorer::kMaxQueryLen ];
+  const __m256i one = _mm256_set1_epi8(1);
+  int i, j;
+
+  for (i = 0; i < query_len; i++)
+    q[ i ] = _mm256_set1_epi8((char) query[ i ]);
+  for (i = 0; i <= query_len; i++)
+    column[ i ] = _mm256_set1_epi8((char) i);
+
+  __m256i len = _mm256_loadu_si256((const __m256i *) lens);
+  __m256i result = _mm256_set1_epi8((char) query_len);
+
+  for (j = 1; j <= max_len; j++) {
+    __m256i c = _mm256_loadu_si256((const __m256i *) cols[ j - 1 ]);
+    __m256i diag = column[ 0 ];
+    __m256i left = column[ 0 ] = _mm256_set1_epi8((char) j);
+    for (i = 1; i <= query_len; i++) {
+      __m256i up = column[ i ];
+      __m256i cost = _mm256_andnot_si256(_mm256_cmpeq_epi8(c, q[ i - 1 ]), one);
+      __m256i v = _mm256_min_epu8(_mm256_adds_epu8(up, one), _mm256_adds_epu8(left, one));
+      v = _mm256_min_epu8(v, _mm256_adds_epu8(diag, cost));
+      column[ i ] = left = v;
+      diag = up;
+    }
+    __m256i done = _mm256_cmpeq_epi8(len, _mm256_set1_epi8((char) j));
+    result = _mm256_blendv_epi8(result, column[ query_len ], done);
+  }
+  _mm256_storeu_si256((__m256i *) out, result);
+}
+
+#endif  // BATCH_SCORER_X86
+
+// Kernels by name, widest first
+static const struct {
+  const char *name;
+  const char *feature;    // CPU feature it needs, NULL == none
+  ScoreKernel kernel;
+} _kernels[] = {
+#if defined(BATCH_SCORER_X86)
+  { "avx2", "avx2", ScoreAvx2 },
+  { "sse2", "sse2", ScoreSse2 },
+#endif
+  { "scalar", NULL, ScoreScalar },
+  { "none", NULL, NULL },
+};
+static const int _kernelCount = sizeof(_kernels) / sizeof(_kernels[ 0 ]);
+
+// Supported
+// Can this CPU run a kernel?
+//
+// @In:     index entry in _kernels
+// @Out:    true == supported
+static bool Supported(int index)
+{
+  const char *feature = _kernels[ index ].feature;
+#if defined(BATCH_SCORER_X86)
+  __builtin_cpu_init();
+  if (feature && !strcmp(feature, "avx2"))
+    return __builtin_cpu_supports("avx2");
+  if (feature && !strcmp(feature, "sse2"))
+    return __builtin_cpu_supports("sse2");
+#endif
+  return !feature;
+}
+
+// SelectKernel
+// Pick the widest kernel this CPU supports.
+//
+// @In:     name receives a printable kernel name
+// @Out:    kernel
+static ScoreKernel SelectKernel(const char **name)
+{
+  int i = 0;
+  while (!Supported(i))
+    i++;
+  *name = _kernels[ i ].name;
+  return _kernels[ i ].kernel;
+}
+
+static const char *_kernelName = NULL;
+static ScoreKernel _kernel = SelectKernel(&_kernelName);
+
+// BatchScorer
+//
+// @In:     query pointer to null-terminated query; must outlive the scorer
+BatchScorer::BatchScorer(const char *query)
+{
+  query_ = (const UCHAR *) query;
+  query_len_ = (int) strlen(query);
+  memset(cols_, 0, sizeof(cols_));
+  Clear();
+}
+
+// Add
+// Queue a candidate for scoring.
+//
+// @In:     candidate word to score
+// @Out:    false == candidate can't be batched (too long, batch full, or
+//          batching switched off); the caller should score it directly
+bool BatchScorer::Add(const std::string &candidate)
+{
+  int len = (int) candidate.length();
+  if (IsFull() || len > kMaxWordLen || query_len_ > kMaxQueryLen || !_kernel)
+    return false;
+
+  for (int j = 0; j < len; j++)
+    cols_[ j ][ count_ ] = (UCHAR) candidate[ j ];
+  lens_[ count_ ] = (UCHAR) len;
+  words_[ count_ ] = candidate;
+  if (len > max_len_)
+    max_len_ = len;
+  count_++;
+  return true;
+}
+
+// Score
+// Compute distances for every queued candidate.
+//
+// @In:     -
+// @Out:    scores filled with GetCount() distances, in Add order
+void BatchScorer::Score(int *scores)
+{
+  UCHAR out[ kLanes ];
+  _kernel(query_, query_len_, cols_, lens_, max_len_, out);
+  for (int k = 0; k < count_; k++)
+    scores[ k ] = out[ k ];
+}
+
+// Clear
+// Empty the batch.
+//
+// @In:     -
+// @Out:    -
+void BatchScorer::Clear()
+{
+  count_ = 0;
+  max_len_ = 0;
+  memset(lens_, 0, sizeof(lens_));
+}
+
+// GetImplementation
+//
+// @In:     -
+// @Out:    name of the kernel selected for this CPU
+const char *BatchScorer::GetImplementation()
+{
+  return _kernelName;
+}
+
+// SetImplementation
+// Replace the kernel picked for this CPU, for tests and benchmarks. Not
+// safe while any scorer is in use.
+//
+// @In:     name avx2, sse2, scalar, or none to score every candidate
+//          directly
+// @Out:    false == unknown, or not supported by this CPU
+bool BatchScorer::SetImplementation(const char *name)
+{
+  for (int i = 0; i < _kernelCount; i++) {
+    if (strcmp(_kernels[ i ].name, name))
+      continue;
+    if (!Supported(i))
+      return false;
+    _kernel = _kernels[ i ].kernel;
+    _kernelName = _kernels[ i ].name;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,237 @@
+/* Dicto
+ * bench.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "log.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// PerfCounter
+//
+// @In:     type perf event type (PERF_TYPE_*)
+//          config event within the type
+PerfCounter::PerfCounter(uint32_t type, uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd_ = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// ~PerfCounter
+PerfCounter::~PerfCounter()
+{
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+// Start
+// Zero and enable the counter.
+//
+// @In:     -
+// @Out:    -
+void PerfCounter::Start()
+{
+  if (fd_ < 0)
+    return;
+  ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// Stop
+// Disable the counter and read it.
+//
+// @In:     -
+// @Out:    events counted since Start, 0 if not open
+uint64_t PerfCounter::Stop()
+{
+  uint64_t count = 0;
+  if (fd_ < 0)
+    return 0;
+  ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(fd_, &count, sizeof(count)) != sizeof(count))
+    count = 0;
+  return count;
+}
+
+// Counters reported per phase
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} _events[] = {
+  { "cache misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "L1D misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { "dTLB misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+static const int _eventCount = sizeof(_events) / sizeof(_events[ 0 ]);
+
+// Report
+// Print one phase's rate and counter readings.
+//
+// @In:     name phase name
+//          lookups lookups done
+//          seconds elapsed time
+//          counts counter readings, one per _events entry
+//          counters open counters
+// @Out:    -
+static void Report(
+    const char *name,
+    uint64_t lookups,
+    double seconds,
+    const uint64_t *counts,
+    std::vector< PerfCounter * > &counters)
+{
+  std::cout << name << ": " << lookups << " lookups, ";
+  std::cout << (uint64_t) (lookups / seconds) << "/s";
+  for (int i = 0; i < _eventCount; i++) {
+    std::cout << ", " << _events[ i ].name << "/lookup ";
+    if (counters[ i ]->IsOpen())
+      std::cout << (double) counts[ i ] / lookups;
+    else
+      std::cout << "n/a";
+  }
+  std::cout << std::endl;
+}
+
+// RunBenchmark
+// See bench.h.
+//
+// @In:     pTree loaded tree
+//          model cost model letter for the fuzzy phase
+//          lookups number of exact lookups; fuzzy runs 1/100 as many
+// @Out:    -
+void RunBenchmark(TernaryTree *pTree, char model, uint64_t lookups)
+{
+  TNode *root = pTree->GetRoot();
+  std::vector< std::string > words;
+  pTree->Complete("", root, &words, (size_t) -1);
+  if (words.empty() || !lookups) {
+    std::cout << "Nothing to benchmark." << std::endl;
+    return;
+  }
+  std::mt19937 rng(1);
+  std::shuffle(words.begin(), words.end(), rng);
+
+  std::vector< PerfCounter * > counters;
+  for (int i = 0; i < _eventCount; i++)
+    counters.push_back(new PerfCounter(_events[ i ].type, _events[ i ].config));
+  uint64_t counts[ _eventCount ];
+
+  std::cout << words.size() << " words, " << pTree->GetNodeCount() << " nodes, "
+    << BatchScorer::GetImplementation() << " batch scoring";
+  std::ifstream smaps("/proc/self/smaps_rollup");
+  std::string line;
+  unsigned long kb;
+  while (getline(smaps, line))
+    if (1 == sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb))
+      std::cout << ", " << kb << " kB in transparent huge pages";
+  std::cout << "." << std::endl;
+
+  // Exact lookups
+  uint64_t found = 0;
+  Clock::time_point start = Clock::now();
+  for (auto counter : counters)
+    counter->Start();
+  for (uint64_t i = 0; i < lookups; i++)
+    found += pTree->Find(words[ i % words.size() ].c_str(), root);
+  for (int i = 0; i < _eventCount; i++)
+    counts[ i ] = counters[ i ]->Stop();
+  double seconds = std::chrono::duration< double >(Clock::now() - start).count();
+  Report("Find", lookups, seconds, counts, counters);
+  if (found != lookups)
+    std::cout << "  (" << lookups - found << " words not found)" << std::endl;
+
+  // Misspelled words: mostly misses, as in bulk checking the errors
+  std::vector< std::string > typos;
+  for (size_t i = 0; i < words.size(); i++) {
+    std::string word = words[ i ];
+    word[ rng() % word.length() ] = 'a' + rng() % 26;
+    typos.push_back(word);
+  }
+  found = 0;
+  start = Clock::now();
+  for (auto counter : counters)
+    counter->Start();
+  for (uint64_t i = 0; i < lookups; i++)
+    found += pTree->Find(typos[ i % typos.size() ].c_str(), root);
+  for (int i = 0; i < _eventCount; i++)
+    counts[ i ] = counters[ i ]->Stop();
+  seconds = std::chrono::duration< double >(Clock::now() - start).count();
+  Report("Find misspelled", lookups, seconds, counts, counters);
+
+  // Fuzzy lookups are far slower; run a hundredth as many
+  uint64_t fuzzy = lookups / 100 ? lookups / 100 : 1;
+  LOG_LEVEL verbosity = (LOG_LEVEL) GET_LOG_VERBOSITY();
+  SET_VERBOSITY_LEVEL(LOG_SILENT);    // no per-query diagnostics
+  start = Clock::now();
+  for (auto counter : counters)
+    counter->Start();
+  std::vector< uint32_t > latencies;
+  uint64_t partial = 0;
+  latencies.reserve(fuzzy);
+  for (uint64_t i = 0; i < fuzzy; i++) {
+    std::map< int, std::string > results;
+    QueryStatus status;
+    Clock::time_point query = Clock::now();
+    pTree->FuzzyFindWithModel(model, typos[ i % typos.size() ].c_str(), root, &results, &status);
+    latencies.push_back((uint32_t) std::chrono::duration_cast<
+      std::chrono::microseconds >(Clock::now() - query).count());
+    partial += status.partial;
+  }
+  for (int i = 0; i < _eventCount; i++)
+    counts[ i ] = counters[ i ]->Stop();
+  seconds = std::chrono::duration< double >(Clock::now() - start).count();
+  SET_VERBOSITY_LEVEL(verbosity);
+  Report("FuzzyFind", fuzzy, seconds, counts, counters);
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "  latency usec: p50 " << latencies[ fuzzy * 50 / 100 ];
+  std::cout << " p99 " << latencies[ fuzzy * 99 / 100 ];
+  std::cout << " max " << latencies.back();
+  std::cout << ", " << partial << " partial" << std::endl;
+
+  for (auto counter : counters)
+    delete counter;
+}
@@ -0,0 +1,103 @@
+/* Dicto
+ * bloom_filter.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <math.h>
+#include "bloom_filter.h"
+
+const int BloomFilter::kBlockWords;
+
+// Mix
+// Finish an FNV state into well-spread bits (MurmurHash3 fmix64); FNV
+// alone leaves the low bits weak.
+//
+// @In:     key FNV state
+// @Out:    mixed hash
+static inline uint64_t Mix(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+  return key;
+}
+
+// BloomFilter
+// Size for the expected number of keys: m = -n ln(p) / ln(2)^2 bits and
+// k = (m / n) ln(2) hashes. Blocking costs a little accuracy at the same
+// size, so the real rate runs slightly above fp_rate.
+//
+// @In:     items expected number of keys
+//          fp_rate wanted false-positive rate, e.g. 0.01
+BloomFilter::BloomFilter(size_t items, double fp_rate)
+{
+  if (items < 1)
+    items = 1;
+  if (fp_rate <= 0.0 || fp_rate >= 1.0)
+    fp_rate = 0.01;
+  double bits = -(double) items * log(fp_rate) / (M_LN2 * M_LN2);
+  block_count_ = (size_t) ceil(bits / (64.0 * kBlockWords));
+  if (block_count_ < 1)
+    block_count_ = 1;
+  hashes_ = (int) round(bits / items * M_LN2);
+  hashes_ = hashes_ < 1 ? 1 : (hashes_ > 16 ? 16 : hashes_);
+  blocks_.assign(block_count_ * kBlockWords, 0);
+  count_ = 0;
+}
+
+// Add
+//
+// @In:     key key hash from Step()/WordKey()
+// @Out:    -
+void BloomFilter::Add(uint64_t key)
+{
+  uint64_t hash = Mix(key);
+  uint64_t *block = &blocks_[ BlockIndex(hash) ];
+  uint32_t h = (uint32_t) hash;
+  uint32_t delta = (h >> 17) | (h << 15) | 1;
+  for (int i = 0; i < hashes_; i++) {
+    block[ (h >> 6) & (kBlockWords - 1) ] |= 1ull << (h & 63);
+    h += delta;
+  }
+  count_++;
+}
+
+// MayContain
+//
+// @In:     key key hash from Step()/WordKey()
+// @Out:    false == definitely absent
+bool BloomFilter::MayContain(uint64_t key) const
+{
+  uint64_t hash = Mix(key);
+  const uint64_t *block = &blocks_[ BlockIndex(hash) ];
+  uint32_t h = (uint32_t) hash;
+  uint32_t delta = (h >> 17) | (h << 15) | 1;
+  for (int i = 0; i < hashes_; i++) {
+    if (!(block[ (h >> 6) & (kBlockWords - 1) ] & (1ull << (h & 63))))
+      return false;
+    h += delta;
+  }
+  return true;
+}
@@ -0,0 +1,274 @@
+/* Dicto
+ * case_fold.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <string.h>
+#include "case_fold.h"
+
+// Fold
+// Case fold a word. Words that are already folded, which is nearly every
+// query against a lowercase dictionary, are detected in one scan and
+// returned as is without copying.
+//
+// @In:     word pointer to null-terminated UTF-8 string
+//          buffer storage for the folded copy
+// @Out:    word itself, or buffer's contents
+const char *CaseFolder::Fold(const char *word, std::string *buffer)
+{
+  const unsigned char *p = (const unsigned char *) word;
+  while (*p && *p < 0x80 && !(*p >= 'A' && *p <= 'Z'))
+    p++;
+  if (!*p)
+    return word;
+
+  buffer->assign(word, (const char *) p - word);
+  while (*p) {
+    if (*p < 0x80) {
+      buffer->push_back((*p >= 'A' && *p <= 'Z') ? (char) (*p + 32) : (char) *p);
+      p++;
+      continue;
+    }
+    uint32_t cp;
+    int len = Decode(p, &cp);
+    if (!len) {
+      buffer->push_back((char) *p++);    // not UTF-8; keep the byte
+      continue;
+    }
+    uint32_t folded = FoldCodepoint(cp);
+    if (folded == cp)
+      buffer->append((const char *) p, len);
+    else
+      Encode(folded, buffer);
+    p += len;
+  }
+  return buffer->c_str();
+}
+
+// Less
+// Order two words the way the tree does: by their folded bytes.
+//
+// @In:     a, b words to compare
+// @Out:    true == a sorts before b
+bool CaseFolder::Less(const std::string &a, const std::string &b)
+{
+  std::string fa, fb;
+  return strcmp(Fold(a.c_str(), &fa), Fold(b.c_str(), &fb)) < 0;
+}
+
+// Code points whose simple case folding (CaseFolding.txt, status C and
+// S) isn't part of a regular run, sorted
+static const uint32_t kIrregular[][ 2 ] = {
+  { 0x181, 0x253 }, { 0x186, 0x254 }, { 0x189, 0x256 }, { 0x18A, 0x257 },
+  { 0x18E, 0x1DD }, { 0x18F, 0x259 }, { 0x190, 0x25B }, { 0x193, 0x260 },
+  { 0x194, 0x263 }, { 0x196, 0x269 }, { 0x197, 0x268 }, { 0x19C, 0x26F },
+  { 0x19D, 0x272 }, { 0x19F, 0x275 }, { 0x1A6, 0x280 }, { 0x1A9, 0x283 },
+  { 0x1AE, 0x288 }, { 0x1B1, 0x28A }, { 0x1B2, 0x28B }, { 0x1B7, 0x292 },
+  { 0x1C4, 0x1C6 }, { 0x1C5, 0x1C6 }, { 0x1C7, 0x1C9 }, { 0x1C8, 0x1C9 },
+  { 0x1CA, 0x1CC }, { 0x1CB, 0x1CC }, { 0x1F1, 0x1F3 }, { 0x1F2, 0x1F3 },
+  { 0x1F6, 0x195 }, { 0x1F7, 0x1BF }, { 0x220, 0x19E }, { 0x23A, 0x2C65 },
+  { 0x23D, 0x19A }, { 0x23E, 0x2C66 }, { 0x243, 0x180 }, { 0x244, 0x289 },
+  { 0x245, 0x28C }, { 0x345, 0x3B9 }, { 0x37F, 0x3F3 }, { 0x386, 0x3AC },
+  { 0x38C, 0x3CC }, { 0x3C2, 0x3C3 }, { 0x3CF, 0x3D7 }, { 0x3D0, 0x3B2 },
+  { 0x3D1, 0x3B8 }, { 0x3D5, 0x3C6 }, { 0x3D6, 0x3C0 }, { 0x3F0, 0x3BA },
+  { 0x3F1, 0x3C1 }, { 0x3F4, 0x3B8 }, { 0x3F5, 0x3B5 }, { 0x3F7, 0x3F8 },
+  { 0x3F9, 0x3F2 }, { 0x3FA, 0x3FB }, { 0x3FD, 0x37B }, { 0x3FE, 0x37C },
+  { 0x3FF, 0x37D }, { 0x4C0, 0x4CF }, { 0x1E9B, 0x1E61 }, { 0x1E9E, 0xDF },
+  { 0x2126, 0x3C9 }, { 0x212A, 'k' }, { 0x212B, 0xE5 }, { 0x2132, 0x214E },
+  { 0x2183, 0x2184 },
+};
+
+// FoldCodepoint
+// Simple (one to one) case folding of a code point.
+//
+// @In:     cp code point
+// @Out:    folded code point
+uint32_t CaseFolder::FoldCodepoint(uint32_t cp)
+{
+  if (cp < 0x80)
+    return (cp >= 'A' && cp <= 'Z') ? cp + 32 : cp;
+
+  // Latin-1 Supplement
+  if (cp < 0x100) {
+    if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7)
+      return cp + 32;
+    return 0xB5 == cp ? 0x3BC : cp;
+  }
+
+  const size_t count = sizeof(kIrregular) / sizeof(kIrregular[ 0 ]);
+  size_t lo = 0, hi = count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (kIrregular[ mid ][ 0 ] < cp)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < count && kIrregular[ lo ][ 0 ] == cp)
+    return kIrregular[ lo ][ 1 ];
+
+  // Latin Extended-A: mostly upper/lower pairs
+  if (cp < 0x180) {
+    if (0x178 == cp)
+      return 0xFF;
+    if (0x17F == cp)
+      return 's';
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E))
+      return (cp & 1) ? cp + 1 : cp;
+    if (cp >= 0x130 && cp <= 0x131)
+      return cp;              // dotted/dotless i have no simple folding
+    if (0x138 == cp || 0x149 == cp)
+      return cp;
+    return (cp & 1) ? cp : cp + 1;
+  }
+
+  // Latin Extended-B: upper/lower pairs
+  if (cp < 0x250) {
+    if ((cp >= 0x182 && cp <= 0x185) || (cp >= 0x1A0 && cp <= 0x1A5) ||
+        (cp >= 0x1DE && cp <= 0x1EF) || 0x1F4 == cp ||
+        (cp >= 0x1F8 && cp <= 0x21F) || (cp >= 0x222 && cp <= 0x233) ||
+        (cp >= 0x246 && cp <= 0x24F))
+      return (cp & 1) ? cp : cp + 1;
+    if (0x187 == cp || 0x18B == cp || 0x191 == cp || 0x198 == cp ||
+        0x1A7 == cp || 0x1AC == cp || 0x1AF == cp || 0x1B3 == cp ||
+        0x1B5 == cp || 0x1B8 == cp || 0x1BC == cp || 0x23B == cp ||
+        0x241 == cp)
+      return cp + 1;          // lone pairs
+    if (cp >= 0x1CD && cp <= 0x1DC)
+      return (cp & 1) ? cp + 1 : cp;
+    return cp;
+  }
+
+  // Greek
+  if (cp >= 0x370 && cp < 0x400) {
+    if (cp >= 0x388 && cp <= 0x38A)
+      return cp + 37;
+    if (cp >= 0x38E && cp <= 0x38F)
+      return cp + 63;
+    if (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2)
+      return cp + 32;
+    if ((cp >= 0x370 && cp <= 0x373) || 0x376 == cp ||
+        (cp >= 0x3D8 && cp <= 0x3EF))
+      return (cp & 1) ? cp : cp + 1;
+    return cp;
+  }
+
+  // Cyrillic
+  if (cp >= 0x400 && cp < 0x530) {
+    if (cp < 0x410)
+      return cp + 80;
+    if (cp < 0x430)
+      return cp + 32;
+    if (cp >= 0x4C1 && cp <= 0x4CE)
+      return (cp & 1) ? cp + 1 : cp;
+    if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF) ||
+        cp >= 0x4D0)
+      return (cp & 1) ? cp : cp + 1;
+    return cp;
+  }
+
+  // Armenian
+  if (cp >= 0x531 && cp <= 0x556)
+    return cp + 48;
+
+  // Georgian
+  if ((cp >= 0x10A0 && cp <= 0x10C5) || 0x10C7 == cp || 0x10CD == cp)
+    return cp + 0x1C60;
+  if ((cp >= 0x1C90 && cp <= 0x1CBA) || (cp >= 0x1CBD && cp <= 0x1CBF))
+    return cp - 0xBC0;          // Mtavruli
+
+  // Latin Extended Additional
+  if (cp >= 0x1E00 && cp <= 0x1EFF) {
+    if (cp > 0x1E95 && cp < 0x1EA0)
+      return cp;
+    return (cp & 1) ? cp : cp + 1;
+  }
+
+  // Letterlike symbols, number forms, enclosed and fullwidth letters
+  if (cp >= 0x2160 && cp <= 0x216F)
+    return cp + 16;
+  if (cp >= 0x24B6 && cp <= 0x24CF)
+    return cp + 26;
+  if (cp >= 0xFF21 && cp <= 0xFF3A)
+    return cp + 32;
+  return cp;
+}
+
+// Decode
+// Read one UTF-8 sequence.
+//
+// @In:     p pointer to the lead byte
+// @Out:    length of the sequence, 0 == not valid UTF-8
+//          cp code point
+int CaseFolder::Decode(const unsigned char *p, uint32_t *cp)
+{
+  int len;
+  uint32_t min;
+  if (p[ 0 ] >= 0xC2 && p[ 0 ] <= 0xDF) {
+    len = 2;
+    min = 0x80;
+    *cp = p[ 0 ] & 0x1F;
+  } else if (p[ 0 ] >= 0xE0 && p[ 0 ] <= 0xEF) {
+    len = 3;
+    min = 0x800;
+    *cp = p[ 0 ] & 0x0F;
+  } else if (p[ 0 ] >= 0xF0 && p[ 0 ] <= 0xF4) {
+    len = 4;
+    min = 0x10000;
+    *cp = p[ 0 ] & 0x07;
+  } else {
+    return 0;
+  }
+  for (int i = 1; i < len; i++) {
+    if ((p[ i ] & 0xC0) != 0x80)
+      return 0;               // also stops at the terminating null
+    *cp = (*cp << 6) | (p[ i ] & 0x3F);
+  }
+  if (*cp < min || *cp > 0x10FFFF || (*cp >= 0xD800 && *cp <= 0xDFFF))
+    return 0;
+  return len;
+}
+
+// Encode
+// Append a code point as UTF-8.
+//
+// @In:     cp code point
+// @Out:    out appended to
+void CaseFolder::Encode(uint32_t cp, std::string *out)
+{
+  if (cp < 0x80) {
+    out->push_back((char) cp);
+  } else if (cp < 0x800) {
+    out->push_back((char) (0xC0 | (cp >> 6)));
+    out->push_back((char) (0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out->push_back((char) (0xE0 | (cp >> 12)));
+    out->push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back((char) (0x80 | (cp & 0x3F)));
+  } else {
+    out->push_back((char) (0xF0 | (cp >> 18)));
+    out->push_back((char) (0x80 | ((cp >> 12) & 0x3F)));
+    out->push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back((char) (0x80 | (cp & 0x3F)));
+  }
+}
@@ -0,0 +1,180 @@
+/* Dicto
+ * deletion_index.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "case_fold.h"
+#include "deletion_index.h"
+
+// DeletionIndex
+//
+// @In:     max_distance largest edit distance the index can answer
+//          prefix_len number of leading characters used to build variants
+DeletionIndex::DeletionIndex(int max_distance, int prefix_len)
+{
+  max_distance_ = max_distance > 0 ? max_distance : 1;
+  prefix_len_ = prefix_len > max_distance_ ? prefix_len : max_distance_ + 1;
+  sorted_ = true;
+}
+
+// Add
+// Add a word and all of its deletion variants to the index.
+// The word is stored case folded, matching the keys in the ternary tree.
+//
+// @In:     word pointer to null-terminated UTF-8 string
+// @Out:    -
+void DeletionIndex::Add(const char *word)
+{
+  std::string folded;
+  std::string key = CaseFolder::Fold(word, &folded);
+
+  uint32_t id = (uint32_t) words_.size();
+  words_.push_back(key);
+
+  std::vector< uint32_t > hashes;
+  GenerateDeletes(key, max_distance_, &hashes);
+  for (auto hash : hashes) {
+    Entry entry;
+    entry.hash = hash;
+    entry.id = id;
+    entries_.push_back(entry);
+  }
+  sorted_ = false;
+}
+
+// Lookup
+// Collect the ids of all words sharing a deletion variant with the query.
+// Candidates are unverified; the caller must score them.
+//
+// @In:     word pointer to null-terminated query
+//          max_distance edit distance to search (clamped to index maximum)
+// @Out:    ids sorted, unique candidate word ids
+void DeletionIndex::Lookup(
+    const char *word,
+    int max_distance,
+    std::vector< uint32_t > *ids)
+{
+  if (!sorted_)
+    Finalize();
+
+  std::string folded;
+  std::string key = CaseFolder::Fold(word, &folded);
+
+  if (max_distance <= 0 || max_distance > max_distance_)
+    max_distance = max_distance_;
+
+  std::vector< uint32_t > hashes;
+  GenerateDeletes(key, max_distance, &hashes);
+  for (auto hash : hashes) {
+    Entry probe;
+    probe.hash = hash;
+    probe.id = 0;
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), probe);
+    for (; it != entries_.end() && it->hash == hash; ++it)
+      ids->push_back(it->id);
+  }
+  std::sort(ids->begin(), ids->end());
+  ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+}
+
+// Finalize
+// Sort the variant table so lookups can binary search it. Lookup does
+// this on demand; call it up front before sharing the index between
+// threads.
+//
+// @In:     -
+// @Out:    -
+void DeletionIndex::Finalize()
+{
+  std::sort(entries_.begin(), entries_.end());
+  entries_.erase(
+    std::unique(entries_.begin(), entries_.end(),
+      [](const Entry &a, const Entry &b) {
+        return a.hash == b.hash && a.id == b.id;
+      }),
+    entries_.end());
+  entries_.shrink_to_fit();
+  sorted_ = true;
+}
+
+// GenerateDeletes
+// Produce the hashes of every string reachable from the word's prefix by
+// deleting up to max_distance characters, including the prefix itself.
+// Short words delete all the way down to "", so a query matches any word
+// it could turn into by deleting everything.
+//
+// @In:     word source string
+//          max_distance number of deletions to apply
+// @Out:    hashes unique variant hashes
+void DeletionIndex::GenerateDeletes(
+    const std::string &word,
+    int max_distance,
+    std::vector< uint32_t > *hashes)
+{
+  std::vector< std::string > level;
+  std::vector< std::string > next;
+  level.push_back(word.substr(0, prefix_len_));
+  hashes->push_back(Hash(level[ 0 ].c_str(), level[ 0 ].length()));
+
+  for (int d = 0; d < max_distance; d++) {
+    next.clear();
+    for (auto &s : level) {
+      if (s.empty())
+        continue;
+      for (size_t i = 0; i < s.length(); i++) {
+        // Skip deletions that repeat the previous character; they
+        // produce the same variant.
+        if (i && s[ i ] == s[ i - 1 ])
+          continue;
+        next.push_back(s.substr(0, i) + s.substr(i + 1));
+      }
+    }
+    std::sort(next.begin(), next.end());
+    next.erase(std::unique(next.begin(), next.end()), next.end());
+    for (auto &s : next)
+      hashes->push_back(Hash(s.c_str(), s.length()));
+    level.swap(next);
+  }
+
+  std::sort(hashes->begin(), hashes->end());
+  hashes->erase(std::unique(hashes->begin(), hashes->end()), hashes->end());
+}
+
+// Hash
+// 32-bit FNV-1a.
+//
+// @In:     s string
+//          len length of string
+// @Out:    hash
+uint32_t DeletionIndex::Hash(const char *s, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char) s[ i ];
+    hash *= 16777619u;
+  }
+  return hash;
+}
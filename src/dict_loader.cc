@@ -0,0 +1,480 @@
+/* Dicto
+ * dict_loader.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+#include "dict_loader.h"
+#include "log.h"
+
+const size_t DictionaryLoader::kMaxWordLen;
+const size_t DictionaryLoader::kMaxReported;
+const size_t DictionaryLoader::kMaxRuns;
+
+// DictionaryLoader
+// The memory budget defaults to half the physical memory.
+DictionaryLoader::DictionaryLoader()
+{
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  budget_ = pages > 0 && page_size > 0 ? (size_t) pages * page_size / 2 : (size_t) 1 << 30;
+  lines_ = blanks_ = duplicates_ = skipped_ = 0;
+  sorted_ = true;
+  external_ = false;
+}
+
+// ~DictionaryLoader
+DictionaryLoader::~DictionaryLoader()
+{
+  Unmap();
+}
+
+// Load
+// Read, validate, sort and de-duplicate a dictionary file. The words stay
+// in the file mapping until the loader is destroyed.
+//
+// @In:     path dictionary file
+// @Out:    false == the file could not be read; see GetError()
+bool DictionaryLoader::Load(const char *path)
+{
+  Unmap();
+  words_.clear();
+  errors_.clear();
+  error_.clear();
+  lines_ = blanks_ = duplicates_ = skipped_ = 0;
+  sorted_ = true;
+  external_ = false;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error_ = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  const char *data;
+  size_t size;
+  bool ok = Map(path, fd, &data, &size);
+  close(fd);
+  if (!ok)
+    return false;
+
+  if (size > budget_) {
+    external_ = true;
+    return ExternalSort(data, size, path);
+  }
+
+  const char *cursor = data;
+  const char *end = data + size;
+  Word word;
+  while (NextLine(&cursor, end, path, &word)) {
+    if (sorted_ && !words_.empty() && Less(word, words_.back()))
+      sorted_ = false;
+    words_.push_back(word);
+  }
+  SortUnique(&words_);
+  return true;
+}
+
+// Build
+// Insert the words into a tree, median first, so each level's siblings
+// form a balanced search tree.
+//
+// @In:     pTree tree to insert into, under its own root
+// @Out:    -
+void DictionaryLoader::Build(TernaryTree *pTree)
+{
+  char buf[ kMaxWordLen + 1 ];
+  BuildRange(pTree, 0, words_.size(), buf);
+}
+
+// BuildRange
+//
+// @In:     pTree tree to insert into
+//          lo first word
+//          hi one past the last word
+//          buf scratch for the null-terminated word
+// @Out:    -
+void DictionaryLoader::BuildRange(
+    TernaryTree *pTree,
+    size_t lo,
+    size_t hi,
+    char *buf)
+{
+  if (lo >= hi)
+    return;
+  size_t mid = lo + ((hi - lo) >> 1);
+  memcpy(buf, words_[ mid ].text, words_[ mid ].len);
+  buf[ words_[ mid ].len ] = '\0';
+  pTree->Insert(buf);
+  BuildRange(pTree, lo, mid, buf);
+  BuildRange(pTree, mid + 1, hi, buf);
+}
+
+// Map
+// Map a whole file read-only.
+//
+// @In:     path file name, for errors
+//          fd open descriptor
+// @Out:    false == failed; see GetError()
+//          pData mapping, NULL for an empty file
+//          pSize file size
+bool DictionaryLoader::Map(
+    const char *path,
+    int fd,
+    const char **pData,
+    size_t *pSize)
+{
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    error_ = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  *pData = NULL;
+  *pSize = (size_t) st.st_size;
+  if (!*pSize)
+    return true;
+
+  void *mem = mmap(NULL, *pSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == mem) {
+    error_ = std::string(path) + ": " + strerror(errno);
+    return false;
+  }
+  madvise(mem, *pSize, MADV_WILLNEED);
+  maps_.push_back(std::make_pair((const char *) mem, *pSize));
+  *pData = (const char *) mem;
+  return true;
+}
+
+// Unmap
+// Release every mapping; words_ must not be used afterwards.
+//
+// @In:     -
+// @Out:    -
+void DictionaryLoader::Unmap()
+{
+  for (auto &map : maps_)
+    munmap((void *) map.first, map.second);
+  maps_.clear();
+}
+
+// NextLine
+// Find the next word, counting lines and skipping blank or invalid ones.
+// Surrounding blanks and a CR before the newline are not part of a word.
+//
+// @In:     pCursor scan position, advanced past the line
+//          end end of the data
+//          path file name, for errors
+// @Out:    false == no more words
+//          word the word found
+bool DictionaryLoader::NextLine(
+    const char **pCursor,
+    const char *end,
+    const char *path,
+    Word *word)
+{
+  while (*pCursor < end) {
+    const char *start = *pCursor;
+    const char *nl = (const char *) memchr(start, '\n', end - start);
+    const char *stop = nl ? nl : end;
+    *pCursor = nl ? nl + 1 : end;
+    lines_++;
+
+    while (start < stop && (' ' == *start || '\t' == *start))
+      start++;
+    while (stop > start && (' ' == stop[ -1 ] || '\t' == stop[ -1 ] || '\r' == stop[ -1 ]))
+      stop--;
+    size_t len = stop - start;
+    if (!len) {
+      blanks_++;
+      continue;
+    }
+    if (memchr(start, '\0', len)) {
+      Skip(path, "NUL byte in word");
+      continue;
+    }
+    if (len > kMaxWordLen) {
+      Skip(path, "word longer than 255 bytes");
+      continue;
+    }
+    word->text = start;
+    word->len = (uint32_t) len;
+    return true;
+  }
+  return false;
+}
+
+// Skip
+// Count an invalid line and keep its report if there's room.
+//
+// @In:     path file name
+//          reason what is wrong with the line
+// @Out:    -
+void DictionaryLoader::Skip(const char *path, const char *reason)
+{
+  skipped_++;
+  if (errors_.size() < kMaxReported)
+    errors_.push_back(std::string(path) + ":" + std::to_string(lines_) + ": " + reason);
+}
+
+// SortUnique
+// Sort words, unless they already are, and drop exact duplicates.
+//
+// @In:     words words to sort
+// @Out:    words sorted and unique
+void DictionaryLoader::SortUnique(std::vector< Word > *words)
+{
+  if (!std::is_sorted(words->begin(), words->end(), Less))
+    std::sort(words->begin(), words->end(), Less);
+  size_t before = words->size();
+  words->erase(
+    std::unique(words->begin(), words->end(),
+      [](const Word &a, const Word &b) {
+        return !Compare(a.text, a.len, b.text, b.len);
+      }),
+    words->end());
+  duplicates_ += before - words->size();
+}
+
+// ExternalSort
+// Sort a file too big for the memory budget: sorted runs of up to budget
+// bytes go to temporary files, which are merged into one more temporary
+// file that is then mapped in place of the input. At most kMaxRuns runs
+// are open at once; when that many have been written they are merged
+// into one before the next.
+//
+// @In:     data input mapping
+//          size input size
+//          path file name, for errors
+// @Out:    false == temporary file trouble; see GetError()
+bool DictionaryLoader::ExternalSort(const char *data, size_t size, const char *path)
+{
+  std::vector< FILE * > runs;
+  std::vector< Word > chunk;
+  size_t bytes = 0;
+  const char *cursor = data;
+  Word word, prev = { NULL, 0 };
+  bool ok = true;
+
+  while (ok && NextLine(&cursor, data + size, path, &word)) {
+    if (sorted_ && prev.text && Less(word, prev))
+      sorted_ = false;
+    prev = word;
+    chunk.push_back(word);
+    bytes += word.len + sizeof(Word);
+    if (bytes >= budget_) {
+      if (runs.size() >= kMaxRuns)
+        ok = CollapseRuns(&runs);
+      ok = ok && WriteRun(&chunk, &runs);
+      bytes = 0;
+    }
+  }
+  if (ok && !chunk.empty() && runs.size() >= kMaxRuns)
+    ok = CollapseRuns(&runs);
+  if (ok && !chunk.empty())
+    ok = WriteRun(&chunk, &runs);
+  Unmap();
+  VERBOSE_LOG(LOG_INFO, "Merging " << runs.size() << " sorted runs." << std::endl);
+
+  FILE *merged = ok ? tmpfile() : NULL;
+  if (ok && !merged) {
+    error_ = std::string("temporary file: ") + strerror(errno);
+    ok = false;
+  }
+  if (ok)
+    ok = MergeRuns(runs, merged);
+  for (auto run : runs)
+    fclose(run);
+  if (!ok) {
+    if (merged)
+      fclose(merged);
+    return false;
+  }
+
+  const char *sorted;
+  size_t sorted_size;
+  ok = Map("temporary file", fileno(merged), &sorted, &sorted_size);
+  fclose(merged);
+  if (!ok)
+    return false;
+
+  // One word per line, already clean
+  const char *end = sorted + sorted_size;
+  for (cursor = sorted; cursor < end; ) {
+    const char *nl = (const char *) memchr(cursor, '\n', end - cursor);
+    word.text = cursor;
+    word.len = (uint32_t) (nl - cursor);
+    words_.push_back(word);
+    cursor = nl + 1;
+  }
+  return true;
+}
+
+// WriteRun
+// Sort a chunk of words into a new temporary file.
+//
+// @In:     words chunk, cleared on return
+// @Out:    false == write failed; see GetError()
+//          runs file appended, positioned at its start
+bool DictionaryLoader::WriteRun(std::vector< Word > *words, std::vector< FILE * > *runs)
+{
+  SortUnique(words);
+  FILE *run = tmpfile();
+  if (!run) {
+    error_ = std::string("temporary file: ") + strerror(errno);
+    return false;
+  }
+  runs->push_back(run);
+  for (auto &word : *words) {
+    fwrite(word.text, 1, word.len, run);
+    fputc('\n', run);
+  }
+  words->clear();
+  if (fflush(run) || ferror(run)) {
+    error_ = std::string("temporary file: ") + strerror(errno);
+    return false;
+  }
+  rewind(run);
+  return true;
+}
+
+// CollapseRuns
+// Merge every run into one, to free file descriptors for more.
+//
+// @In:     runs sorted run files
+// @Out:    false == temporary file trouble; see GetError()
+//          runs the merged run alone, positioned at its start
+bool DictionaryLoader::CollapseRuns(std::vector< FILE * > *runs)
+{
+  FILE *merged = tmpfile();
+  if (!merged) {
+    error_ = std::string("temporary file: ") + strerror(errno);
+    return false;
+  }
+  bool ok = MergeRuns(*runs, merged);
+  for (auto run : *runs)
+    fclose(run);
+  runs->assign(1, merged);
+  rewind(merged);
+  return ok;
+}
+
+// MergeRuns
+// k-way merge of sorted runs, dropping words repeated across runs.
+//
+// @In:     runs sorted run files
+// @Out:    false == read or write failed; see GetError()
+//          out merged words, one per line, flushed
+bool DictionaryLoader::MergeRuns(std::vector< FILE * > &runs, FILE *out)
+{
+  struct Head {
+    char *line;
+    size_t cap;
+    ssize_t len;
+  };
+  std::vector< Head > heads(runs.size(), Head { NULL, 0, 0 });
+  auto greater = [&heads](size_t a, size_t b) {
+    int cmp = Compare(heads[ a ].line, heads[ a ].len, heads[ b ].line, heads[ b ].len);
+    return cmp > 0 || (!cmp && a > b);
+  };
+  std::priority_queue< size_t, std::vector< size_t >, decltype(greater) > pending(greater);
+
+  for (size_t i = 0; i < runs.size(); i++) {
+    heads[ i ].len = getline(&heads[ i ].line, &heads[ i ].cap, runs[ i ]);
+    if (heads[ i ].len > 0) {
+      heads[ i ].len--;     // newline
+      pending.push(i);
+    }
+  }
+
+  std::string last;
+  bool have_last = false;
+  while (!pending.empty()) {
+    size_t i = pending.top();
+    pending.pop();
+    Head &head = heads[ i ];
+    if (have_last && !Compare(last.data(), last.length(), head.line, head.len)) {
+      duplicates_++;
+    } else {
+      fwrite(head.line, 1, head.len, out);
+      fputc('\n', out);
+      last.assign(head.line, head.len);
+      have_last = true;
+    }
+    head.len = getline(&head.line, &head.cap, runs[ i ]);
+    if (head.len > 0) {
+      head.len--;
+      pending.push(i);
+    }
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < runs.size(); i++) {
+    free(heads[ i ].line);
+    ok = ok && !ferror(runs[ i ]);
+  }
+  if (fflush(out) || ferror(out))
+    ok = false;
+  if (!ok)
+    error_ = std::string("temporary file: ") + strerror(errno);
+  return ok;
+}
+
+// Less
+// Dictionary order: case-folded first, so "Hell" and "hell" sit together
+// the way the tree stores them, then by raw bytes.
+//
+// @In:     a, b words
+// @Out:    true == a sorts before b
+bool DictionaryLoader::Less(const Word &a, const Word &b)
+{
+  return Compare(a.text, a.len, b.text, b.len) < 0;
+}
+
+// Compare
+//
+// @In:     a, a_len first word
+//          b, b_len second word
+// @Out:    <0, 0, >0 as a sorts before, with or after b
+int DictionaryLoader::Compare(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+  size_t len = a_len < b_len ? a_len : b_len;
+  for (size_t i = 0; i < len; i++) {
+    int ca = tolower((unsigned char) a[ i ]);
+    int cb = tolower((unsigned char) b[ i ]);
+    if (ca != cb)
+      return ca - cb;
+  }
+  if (a_len != b_len)
+    return a_len < b_len ? -1 : 1;
+  return memcmp(a, b, len);
+}
@@ -0,0 +1,51 @@
+/* Dicto
+ * edit_cost.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <ctype.h>
+#include "edit_cost.h"
+
+signed char KeyboardCost::row_[ 256 ];
+signed char KeyboardCost::col_[ 256 ];
+
+// KeyboardLayout
+// Fills KeyboardCost's position tables at startup. Columns are in half
+// keys so the stagger between rows is kept: "a" sits between "q" and
+// "w", "z" between "a" and "s".
+static struct KeyboardLayout {
+  KeyboardLayout() {
+    static const char *rows[] = { "qwertyuiop", "asdfghjkl", "zxcvbnm" };
+    int r, c;
+    for (c = 0; c < 256; c++)
+      KeyboardCost::row_[ c ] = KeyboardCost::col_[ c ] = -1;
+    for (r = 0; r < 3; r++) {
+      for (c = 0; rows[ r ][ c ]; c++) {
+        UCHAR key = (UCHAR) rows[ r ][ c ];
+        UCHAR upper = (UCHAR) toupper(key);
+        KeyboardCost::row_[ key ] = KeyboardCost::row_[ upper ] = (signed char) r;
+        KeyboardCost::col_[ key ] = KeyboardCost::col_[ upper ] = (signed char) (c * 2 + r);
+      }
+    }
+  }
+} _keyboardLayout;
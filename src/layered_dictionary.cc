@@ -0,0 +1,370 @@
+/* Dicto
+ * layered_dictionary.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "layered_dictionary.h"
+#include "log.h"
+
+// LayeredDictionary
+// The overlay trees take the base's distance limit, and the additions
+// its deletion index settings, so every layer is searched the same way.
+//
+// @In:     pBase loaded tree to layer over; must outlive this object
+LayeredDictionary::LayeredDictionary(TernaryTree *pBase)
+{
+  base_ = pBase;
+  added_ = 0;
+  suppressed_ = 0;
+  adds_.SetMaxDifference(base_->GetMaxDifference());
+  removes_.SetMaxDifference(base_->GetMaxDifference());
+  DeletionIndex *index = base_->GetDeletionIndex();
+  if (index)
+    adds_.EnableDeletionIndex(index->GetMaxDistance(), index->GetPrefixLength());
+}
+
+// Add
+// Make a word present for this tenant. A base word that was suppressed
+// is simply unsuppressed; the additions tree only grows for words the
+// base doesn't have.
+//
+// @In:     word pointer to null-terminated string
+// @Out:    -
+void LayeredDictionary::Add(const char *word)
+{
+  if (!*word)
+    return;
+  if (Unset(&removes_, word))
+    suppressed_--;
+  if (base_->Find(word, base_->GetRoot()) || adds_.Find(word, adds_.GetRoot()))
+    return;
+  adds_.Insert(word);
+  added_++;
+}
+
+// Suppress
+// Hide a word from this tenant, whether it came from the base or an
+// earlier Add.
+//
+// @In:     word pointer to null-terminated string
+// @Out:    -
+void LayeredDictionary::Suppress(const char *word)
+{
+  if (!*word)
+    return;
+  if (Unset(&adds_, word))
+    added_--;
+  if (!base_->Find(word, base_->GetRoot()) || removes_.Find(word, removes_.GetRoot()))
+    return;
+  removes_.Insert(word);
+  suppressed_++;
+}
+
+// Load
+// Apply a tenant file: one word per line, added, or suppressed when it
+// starts with '-'. A leading '+' is allowed for symmetry; blank lines are
+// skipped. Lines apply in file order. The result is ready to be shared
+// between threads.
+//
+// @In:     path file to read
+// @Out:    false == the file could not be read
+bool LayeredDictionary::Load(const char *path)
+{
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    while (!line.empty() && ('\r' == line.back() || ' ' == line.back()))
+      line.pop_back();
+    if (line.empty())
+      continue;
+    if ('-' == line[ 0 ])
+      Suppress(line.c_str() + 1);
+    else
+      Add(line.c_str() + ('+' == line[ 0 ]));
+  }
+  Finalize();
+  VERBOSE_LOG(LOG_INFO, "Overlay " << path << ": " << added_ << " added, "
+    << suppressed_ << " suppressed, " << GetNodeCount() << " nodes." << std::endl);
+  return !in.bad();
+}
+
+// Finalize
+// Prepare the additions' deletion index, if any, for lookups. Queries do
+// this on demand; call it after the last Add before sharing the
+// dictionary between threads.
+//
+// @In:     -
+// @Out:    -
+void LayeredDictionary::Finalize()
+{
+  if (adds_.GetDeletionIndex())
+    adds_.GetDeletionIndex()->Finalize();
+}
+
+// Find
+// Exact lookup across the layers.
+//
+// @In:     word pointer to null-terminated string
+// @Out:    true == word present for this tenant
+bool LayeredDictionary::Find(const char *word)
+{
+  if (added_ && adds_.Find(word, adds_.GetRoot()))
+    return true;
+  if (suppressed_ && removes_.Find(word, removes_.GetRoot()))
+    return false;
+  return base_->Find(word, base_->GetRoot());
+}
+
+// Complete
+// List the words beginning with a prefix, in folded order, merging the
+// base's completions (less the suppressed ones) with the additions. The
+// base is asked for more words, doubling each time, until enough of them
+// survive the suppressions or it has no more; every spelling of a word
+// comes back separately, so the count of suppressed keys alone can't say
+// how many to ask for.
+//
+// @In:     prefix pointer to null-terminated prefix; "" lists everything
+//          limit most words to return, SIZE_MAX == all
+// @Out:    number of words added
+//          words filled with completions
+size_t LayeredDictionary::Complete(
+    const char *prefix,
+    std::vector< std::string > *words,
+    size_t limit)
+{
+  std::vector< std::string > base_words;
+  std::vector< std::string > added;
+  size_t want = limit;
+  for (;;) {
+    base_words.clear();
+    size_t got = base_->Complete(prefix, base_->GetRoot(), &base_words, want);
+    size_t live = got;
+    for (size_t i = 0; suppressed_ && i < base_words.size(); i++)
+      if (removes_.Find(base_words[ i ].c_str(), removes_.GetRoot()))
+        live--;
+    if (live >= limit || got < want)
+      break;
+    want = want > SIZE_MAX / 2 ? SIZE_MAX : want * 2;
+  }
+  if (added_)
+    adds_.Complete(prefix, adds_.GetRoot(), &added, limit);
+
+  size_t start = words->size();
+  size_t i = 0, j = 0;
+  while (words->size() - start < limit) {
+    if (i < base_words.size() &&
+        suppressed_ && removes_.Find(base_words[ i ].c_str(), removes_.GetRoot())) {
+      i++;
+      continue;
+    }
+    if (i < base_words.size() &&
+        (j >= added.size() || CaseFolder::Less(base_words[ i ], added[ j ])))
+      words->push_back(base_words[ i++ ]);
+    else if (j < added.size())
+      words->push_back(added[ j++ ]);
+    else
+      break;
+  }
+  return words->size() - start;
+}
+
+// FuzzyFindWithModel
+// Fuzzy lookup across the layers, returning what one tree holding the
+// tenant's words would. Every layer extrapolates from the stem that tree
+// would pick (see GetStem), and the scores are merged. Suppressed base
+// words are dropped before merging, as are additions undone since (the
+// deletion index still holds them).
+//
+// The layers share one budget: the base is searched first and the
+// additions get what it left. A limit the base used up exactly still
+// lets the additions show they needed nothing more; they are given one
+// unit of it, and if they spend it their results are dropped and the
+// query is partial.
+//
+// @In:     model cost model letter (see TernaryTree::FuzzyFindWithModel)
+//          word pointer to null-terminated string
+//          pBudget work limits for the whole lookup, NULL == the base's
+// @Out:    words key/value pair map with tiebroken score and word
+//          pStatus work done over all layers; partial if any layer was
+void LayeredDictionary::FuzzyFindWithModel(
+    char model,
+    const char *word,
+    std::map< int, std::string > *words,
+    QueryStatus *pStatus,
+    const QueryBudget *pBudget)
+{
+  if (!pBudget)
+    pBudget = &base_->GetQueryBudget();
+  if (!added_ && !suppressed_) {
+    base_->FuzzyFindWithModel(model, word, base_->GetRoot(), words,
+      pStatus, pBudget);
+    return;
+  }
+
+  ExtrapolateContext::Clock::time_point start = ExtrapolateContext::Clock::now();
+  size_t stem_len = GetStem(word);
+  std::map< int, std::string > base_words;
+  std::map< int, std::string > added;
+  QueryStatus status;
+  base_->FuzzyFindWithModel(model, word, base_->GetRoot(), &base_words,
+    &status, pBudget, stem_len);
+
+  QueryBudget left;
+  if (added_ && !status.partial &&
+      GetBudgetLeft(*pBudget, status, start, &left)) {
+    QueryStatus added_status;
+    adds_.FuzzyFindWithModel(model, word, adds_.GetRoot(), &added,
+      &added_status, &left, stem_len);
+    bool over =
+      (pBudget->max_visits && status.visits >= pBudget->max_visits &&
+        added_status.visits) ||
+      (pBudget->max_candidates && status.candidates >= pBudget->max_candidates &&
+        added_status.candidates);
+    if (over) {
+      // The additions needed more than the base left them
+      added.clear();
+      status.partial = true;
+    } else {
+      status.visits += added_status.visits;
+      status.candidates += added_status.candidates;
+      status.partial |= added_status.partial;
+    }
+  } else if (added_) {
+    status.partial = true;
+  }
+
+  std::map< int, int > tie_breaker_lookup;
+  if (suppressed_)
+    MergeScored(base_words, &removes_, false, &tie_breaker_lookup, words);
+  else
+    MergeScored(base_words, NULL, false, &tie_breaker_lookup, words);
+  MergeScored(added, &adds_, true, &tie_breaker_lookup, words);
+  if (pStatus)
+    *pStatus = status;
+}
+
+// GetStem
+// Length of the stem one tree holding the tenant's words would search
+// from: the longest prefix of the folded word that begins some word
+// present for this tenant. Each layer alone may hold a longer prefix, of
+// suppressed or undone words, or a shorter one.
+//
+// @In:     word pointer to null-terminated string
+// @Out:    stem length in folded bytes, 0 == no prefix is present
+size_t LayeredDictionary::GetStem(const char *word)
+{
+  std::string buffer;
+  std::string stem = CaseFolder::Fold(word, &buffer);
+  std::vector< std::string > first;
+  while (!stem.empty()) {
+    first.clear();
+    if (Complete(stem.c_str(), &first, 1))
+      break;
+    stem.pop_back();
+  }
+  return stem.length();
+}
+
+// GetBudgetLeft
+// What a budget has left after some of it was spent. A limit spent
+// exactly is left at one unit, so the caller can tell whether any more
+// was needed.
+//
+// @In:     budget limits for the whole lookup
+//          status work done so far
+//          start when the lookup started
+// @Out:    false == the deadline has passed
+//          pLeft limits for the rest of the lookup
+bool LayeredDictionary::GetBudgetLeft(
+    const QueryBudget &budget,
+    const QueryStatus &status,
+    ExtrapolateContext::Clock::time_point start,
+    QueryBudget *pLeft)
+{
+  *pLeft = budget;
+  if (budget.max_visits)
+    pLeft->max_visits = budget.max_visits > status.visits ?
+      budget.max_visits - status.visits : 1;
+  if (budget.max_candidates)
+    pLeft->max_candidates = budget.max_candidates > status.candidates ?
+      budget.max_candidates - status.candidates : 1;
+  if (budget.deadline_us) {
+    uint64_t elapsed = std::chrono::duration_cast< std::chrono::microseconds >(
+      ExtrapolateContext::Clock::now() - start).count();
+    if (elapsed >= budget.deadline_us)
+      return false;
+    pLeft->deadline_us = budget.deadline_us - elapsed;
+  }
+  return true;
+}
+
+// Unset
+// Clear a word's terminator, leaving its nodes in place for a later
+// re-insert.
+//
+// @In:     pTree overlay tree
+//          word pointer to null-terminated string
+// @Out:    true == the word was in the tree
+bool LayeredDictionary::Unset(TernaryTree *pTree, const char *word)
+{
+  TNode *node = NULL;
+  if (!pTree->Find(word, pTree->GetRoot(), &node) || !node)
+    return false;
+  node->ClearTerminator();
+  return true;
+}
+
+// MergeScored
+// Re-key one layer's fuzzy results into the merged map, tiebreaking
+// scores across layers the way TernaryTree::AddScoredWord does within one.
+//
+// @In:     from one layer's results, keyed by tiebroken score
+//          pFilter tree deciding which words are merged, may be NULL
+//          keep true == merge only words in pFilter, false == leave them out
+// @Out:    tie_breaker_lookup last tiebreaker used per score
+//          words merged results
+void LayeredDictionary::MergeScored(
+    const std::map< int, std::string > &from,
+    TernaryTree *pFilter,
+    bool keep,
+    std::map< int, int > *tie_breaker_lookup,
+    std::map< int, std::string > *words)
+{
+  for (auto &it : from) {
+    if (pFilter && pFilter->Find(it.second.c_str(), pFilter->GetRoot()) != keep)
+      continue;
+    int score = it.first >> 12;
+    int tie_breaker = 0;
+    if (tie_breaker_lookup->count(score))
+      tie_breaker = ++(*tie_breaker_lookup)[ score ];
+    else
+      (*tie_breaker_lookup)[ score ] = 0;
+    (*words)[ tie_breaker + (score << 12) ] = it.second;
+  }
+}
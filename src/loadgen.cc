@@ -0,0 +1,217 @@
+/* Dicto
+ * loadgen.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <thread>
+#include "loadgen.h"
+#include "server.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// LoadGenerator
+//
+// @In:     words dictionary words to draw queries from; must outlive Run
+LoadGenerator::LoadGenerator(const std::vector< std::string > &words)
+  : words_(words)
+{
+}
+
+// Run
+// Connect, run the load and print throughput and latency percentiles.
+//
+// @In:     address server address (see QueryServer)
+//          connections number of concurrent connections
+//          depth requests kept in flight per connection
+//          requests total number of requests across all connections
+//          ops op mix, e.g. "FZC"
+// @Out:    false == no words, or a connection failed
+bool LoadGenerator::Run(
+    const char *address,
+    int connections,
+    int depth,
+    uint64_t requests,
+    const char *ops)
+{
+  if (words_.empty() || connections <= 0 || depth <= 0 || !*ops)
+    return false;
+
+  // Connect everything up front so setup isn't timed
+  std::vector< int > fds;
+  for (int i = 0; i < connections; i++) {
+    int fd = QueryServer::Connect(address);
+    if (fd < 0) {
+      std::cerr << "Cannot connect to " << address << ": " << strerror(errno) << std::endl;
+      for (auto f : fds)
+        close(f);
+      return false;
+    }
+    fds.push_back(fd);
+  }
+
+  latencies_.assign(connections, std::vector< uint32_t >());
+  errors_.assign(connections, 0);
+
+  std::vector< std::thread > threads;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < connections; i++) {
+    uint64_t count = requests / connections + ((uint64_t) i < requests % connections ? 1 : 0);
+    threads.push_back(std::thread(
+      &LoadGenerator::ConnectionLoop, this, i, fds[ i ], count, depth, ops));
+  }
+  for (auto &thread : threads)
+    thread.join();
+  double seconds = std::chrono::duration< double >(Clock::now() - start).count();
+  for (auto fd : fds)
+    close(fd);
+
+  std::vector< uint32_t > all;
+  int errors = 0;
+  for (int i = 0; i < connections; i++) {
+    all.insert(all.end(), latencies_[ i ].begin(), latencies_[ i ].end());
+    errors += errors_[ i ];
+  }
+  std::sort(all.begin(), all.end());
+
+  std::cout << "Requests:    " << all.size() << " (" << errors << " errors)" << std::endl;
+  std::cout << "Connections: " << connections << " x depth " << depth << std::endl;
+  std::cout << "Elapsed:     " << seconds << " s" << std::endl;
+  std::cout << "Throughput:  " << (uint64_t) (all.size() / seconds) << " req/s" << std::endl;
+  if (!all.empty()) {
+    std::cout << "Latency usec: p50 " << all[ all.size() * 50 / 100 ];
+    std::cout << " p90 " << all[ all.size() * 90 / 100 ];
+    std::cout << " p99 " << all[ all.size() * 99 / 100 ];
+    std::cout << " max " << all.back() << std::endl;
+  }
+  return all.size() == requests;
+}
+
+// ConnectionLoop
+// Keep depth requests in flight until count replies have arrived.
+// Latency runs from handing a request to the socket to reading the end of
+// its reply line.
+//
+// @In:     index connection number, selects the result slot
+//          fd connected socket
+//          count requests to send on this connection
+//          depth requests in flight
+//          ops op mix
+// @Out:    -
+void LoadGenerator::ConnectionLoop(
+    int index,
+    int fd,
+    uint64_t count,
+    int depth,
+    const char *ops)
+{
+  std::vector< uint32_t > &latencies = latencies_[ index ];
+  std::deque< Clock::time_point > sent_at;
+  uint64_t rng = 0x9e3779b97f4a7c15ull * (index + 1);
+  uint64_t sent = 0;
+  std::string out, in;
+  char buf[ 65536 ];
+
+  latencies.reserve(count);
+  while (latencies.size() < count) {
+    // Top up the pipeline
+    out.clear();
+    Clock::time_point now = Clock::now();
+    while (sent < count && sent_at.size() < (size_t) depth) {
+      MakeRequest(&rng, ops, &out);
+      sent_at.push_back(now);
+      sent++;
+    }
+    for (size_t off = 0; off < out.length(); ) {
+      ssize_t n = send(fd, out.data() + off, out.length() - off, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        errors_[ index ] += count - latencies.size();
+        return;
+      }
+      off += n;
+    }
+
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      errors_[ index ] += count - latencies.size();
+      return;
+    }
+    in.append(buf, n);
+
+    now = Clock::now();
+    size_t start = 0, end;
+    while ((end = in.find('\n', start)) != std::string::npos) {
+      if (in[ start ] == 'E')
+        errors_[ index ]++;
+      latencies.push_back((uint32_t) std::chrono::duration_cast<
+        std::chrono::microseconds >(now - sent_at.front()).count());
+      sent_at.pop_front();
+      start = end + 1;
+    }
+    in.erase(0, start);
+  }
+}
+
+// MakeRequest
+// Append one random request line.
+//
+// @In:     rng xorshift state
+//          ops op mix
+// @Out:    out request appended
+void LoadGenerator::MakeRequest(uint64_t *rng, const char *ops, std::string *out)
+{
+  *rng ^= *rng << 13;
+  *rng ^= *rng >> 7;
+  *rng ^= *rng << 17;
+  uint64_t r = *rng;
+
+  char op = ops[ r % strlen(ops) ];
+  std::string word = words_[ (r >> 16) % words_.size() ].substr(0, QueryServer::kMaxLine - 2);
+  switch (op) {
+    case 'Z':
+      if (!word.empty())
+        word[ (r >> 40) % word.length() ] = 'a' + (r >> 48) % 26;
+      break;
+    case 'C':
+      word = word.substr(0, 3);
+      break;
+    default:
+      op = 'F';
+      break;
+  }
+  *out += op;
+  *out += ' ';
+  *out += word;
+  *out += '\n';
+}
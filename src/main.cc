@@ -27,77 +27,60 @@
 #include <stdio.h>
 #include <assert.h>
 #include <memory.h>
-#include <fstream>
+#include <string.h>
 #include <string>
 #include <set>
 #include <stack>
 #include <queue>
 #include <deque>
 #include <algorithm>
+#include <thread>
+#include <vector>
 #include "templ_node.h"
 #include "ternary_tree.h"
 #include "log.h"
-
-int GetWordCount(std::ifstream *file)
-{
-  int lineTot = std::count(std::istreambuf_iterator<char>(*file),
-      std::istreambuf_iterator<char>(), '\n');
-
-  file->seekg(0);
-  return lineTot;
-}
+#include "server.h"
+#include "loadgen.h"
+#include "bench.h"
+#include "replica.h"
+#include "dict_loader.h"
+#include "layered_dictionary.h"
 
 // ReadDictionaryFile
-// Read dictionary file into our data structure.
-// TODO (RFE): Would be nice to have the tree self-balance
-// instead of reading the sorted file in two halves...
+// Read dictionary file into our data structure. Skipped lines are
+// reported on stderr.
 //
-// @In:     -
-// @Out:    -
-void ReadDictionaryFile(const char *path, TernaryTree *pTree, TNode *& pRoot)
+// @In:     path dictionary file
+//          pTree tree to fill
+//          budget bytes to sort in memory, 0 == loader default
+// @Out:    true == loaded
+//          pRoot root of the tree
+bool ReadDictionaryFile(
+    const char *path,
+    TernaryTree *pTree,
+    TNode *& pRoot,
+    size_t budget)
 {
-  try
-  {
-    std::ifstream file(path);
-    std::string line;
-    int lineTot = GetWordCount(&file);
-    int start = lineTot >> 1;
-    int idx = 0;
-
-    VERBOSE_LOG(LOG_INFO, "Reading " << lineTot << " words." << std::endl);
-
-    // Begin at middle of file
-    while (idx < start)
-    {
-      getline(file, line);
-      idx++;
-    }
-
-    // Insert second half
-    VERBOSE_LOG(LOG_INFO, "Reading phase 1..." << std::endl);
-    while (getline(file, line) )
-    {
-      VERBOSE_LOG(LOG_DEBUG, "|" << line.c_str() << "|" << std::endl);
-      pTree->Insert(line.c_str(), &pRoot);
-    }
-
-    // Insert first half
-    VERBOSE_LOG(LOG_INFO, "Reading phase 2..." << std::endl);
-    idx = 0;
-    file.clear();
-    file.seekg(0, std::ios::beg);
-    while (idx < start)
-    {
-      getline(file, line);
-      VERBOSE_LOG(LOG_DEBUG, "|" << line.c_str() << "|" << std::endl);
-      pTree->Insert(line.c_str(), &pRoot);
-      idx++;
-    }
-  }
-  catch(...)
-  {
-    VERBOSE_LOG(0, "Error reading file." );
+  DictionaryLoader loader;
+  if (budget)
+    loader.SetMemoryBudget(budget);
+  if (!loader.Load(path)) {
+    std::cerr << "Error reading dictionary: " << loader.GetError() << std::endl;
+    return false;
   }
+  for (auto &error : loader.GetErrors())
+    std::cerr << error << std::endl;
+  if (loader.GetSkippedCount() > loader.GetErrors().size())
+    std::cerr << "(" << loader.GetSkippedCount() - loader.GetErrors().size() << " more lines skipped)" << std::endl;
+
+  VERBOSE_LOG(LOG_INFO, "Read " << loader.GetLineCount() << " lines: " << loader.GetWordCount() << " words, "
+    << loader.GetDuplicateCount() << " duplicates, " << loader.GetBlankCount() << " blank, "
+    << loader.GetSkippedCount() << " skipped" << (loader.WasSorted() ? "" : ", unsorted")
+    << (loader.WasExternal() ? ", sorted externally" : "") << "." << std::endl);
+  loader.Build(pTree);
+  pRoot = pTree->GetRoot();
+  VERBOSE_LOG(LOG_INFO, pTree->GetNodeCount() << " nodes." << std::endl);
+  return true;
 }
 
 // OutputPreamble
@@ -137,6 +120,26 @@ void PrintUsage()
   std::cout << "Flags:" << std::endl;
   std::cout << "\t-v set verbosity: -v0 none -v1 info -v2 debug" << std::endl;
   std::cout << "\t-d set maximum Levenshtein distance, example -d18" << std::endl;
+  std::cout << "\t-m select edit cost model: -mu Levenshtein (default) -md Damerau" << std::endl;
+  std::cout << "\t   -mc case-insensitive -mk keyboard distance (scores in half edits)" << std::endl;
+  std::cout << "\t-r index the top 1 or 2 character levels directly, example -r2" << std::endl;
+  std::cout << "\t-c0 disable path compression of single-child runs" << std::endl;
+  std::cout << "\t-i build deletion index for small distances: -i<dist>[,<prefix>], example -i2,7" << std::endl;
+  std::cout << "\t-l node layout after loading: -ld depth-first (default) -lv van Emde Boas -l0 as inserted" << std::endl;
+  std::cout << "\t-p back the laid out nodes with huge pages: -pt transparent -pe explicit (hugetlbfs)" << std::endl;
+  std::cout << "\t-n1 with --serve, replicate the tree on every NUMA node" << std::endl;
+  std::cout << "\t-b prefilter lookups with a Bloom filter: -b<false positive rate>, example -b0.01" << std::endl;
+  std::cout << "\t--sort-mem=MB sort dictionaries larger than this in temporary files (default: half of RAM)" << std::endl;
+  std::cout << "\t--max-visits=N --max-candidates=N --deadline-us=N limit the work per fuzzy lookup;" << std::endl;
+  std::cout << "\t   a lookup that hits a limit returns the best words found so far, marked partial" << std::endl;
+  std::cout << "\t--overlay=FILE layer a tenant's words over dict.txt for interactive lookups: one per line," << std::endl;
+  std::cout << "\t   a leading '-' hides a dictionary word" << std::endl;
+  std::cout << "\t--bench=N time N exact (and N/100 fuzzy) lookups and report cache misses" << std::endl;
+  std::cout << "\t--batch=avx2|sse2|scalar|none override the batch scoring kernel picked for this CPU" << std::endl;
+  std::cout << "\t--serve=<addr> serve queries on a Unix socket path or [127.0.0.1:]port" << std::endl;
+  std::cout << "\t--threads=N worker threads for --serve (default: hardware threads)" << std::endl;
+  std::cout << "\t--loadgen=<addr> benchmark a running server; tune with" << std::endl;
+  std::cout << "\t   --connections=N --depth=N --requests=N --ops=FZC (op letters, picked uniformly)" << std::endl;
 }
 
 // LEG is used for PrintTraversal to tell what leg the current node is on.
@@ -237,15 +240,77 @@ int main(int argc, const char *argv[])
   const int MAX_IN = 128;
   TNode *pRoot = NULL;
   TernaryTree t;
+  char model = 'u';
+  const char *serve = NULL;
+  const char *loadgen = NULL;
+  const char *overlay = NULL;
+  const char *ops = "FZC";
+  int threads = (int) std::thread::hardware_concurrency();
+  int connections = 4;
+  int depth = 16;
+  unsigned long long requests = 100000;
+  bool verbose = false;
+  LAYOUT layout = LAYOUT_DFS;
+  unsigned long long bench = 0;
+  bool replicate = false;
+  size_t sort_mem = 0;
+  double bloom_fp = 0.0;
+  QueryBudget budget;
 
   // parseargs
   if (1 < argc) {
     int i = 1;
     while (i < argc) {
-      if ('-' == argv[i][0]) {
+      if ('-' == argv[i][0] && '-' == argv[i][1]) {
+        const char *arg = &argv[i][2];
+        const char *value = strchr(arg, '=');
+        std::string name(arg, value ? value - arg : strlen(arg));
+        if (!value) {
+          PrintUsage();
+          return 1;
+        }
+        value++;
+        if (name == "serve")
+          serve = value;
+        else if (name == "loadgen")
+          loadgen = value;
+        else if (name == "threads")
+          threads = atoi(value);
+        else if (name == "connections")
+          connections = atoi(value);
+        else if (name == "depth")
+          depth = atoi(value);
+        else if (name == "requests")
+          requests = strtoull(value, NULL, 10);
+        else if (name == "ops")
+          ops = value;
+        else if (name == "sort-mem")
+          sort_mem = (size_t) strtoull(value, NULL, 10) << 20;
+        else if (name == "max-visits")
+          budget.max_visits = (size_t) strtoull(value, NULL, 10);
+        else if (name == "max-candidates")
+          budget.max_candidates = (size_t) strtoull(value, NULL, 10);
+        else if (name == "deadline-us")
+          budget.deadline_us = strtoull(value, NULL, 10);
+        else if (name == "overlay")
+          overlay = value;
+        else if (name == "bench")
+          bench = strtoull(value, NULL, 10);
+        else if (name == "batch") {
+          if (!BatchScorer::SetImplementation(value)) {
+            std::cerr << "Batch scorer " << value << " not available." << std::endl;
+            return 1;
+          }
+        }
+        else {
+          PrintUsage();
+          return 1;
+        }
+      } else if ('-' == argv[i][0]) {
         switch(argv[i][1]) {
           case 'v':
             {
+              verbose = true;
               int verbosity;
               if (isdigit(verbosity = argv[i][2])) {
                 LOG_LEVEL ll = (LOG_LEVEL) (verbosity - (int) '0');
@@ -263,7 +328,73 @@ int main(int argc, const char *argv[])
               }
             }
             break;
-
+          case 'm':
+            if (!argv[i][2] || !strchr("udck", argv[i][2])) {
+              PrintUsage();
+              return 1;
+            }
+            model = argv[i][2];
+            break;
+          case 'r':
+            {
+              int levels = 2;
+              sscanf(&argv[i][2], "%d", &levels);
+              t.EnableRootTable(levels);
+            }
+            break;
+          case 'l':
+            switch (argv[i][2]) {
+              case '0':
+                layout = LAYOUT_NONE;
+                break;
+              case 'd':
+                layout = LAYOUT_DFS;
+                break;
+              case 'v':
+                layout = LAYOUT_VEB;
+                break;
+              default:
+                PrintUsage();
+                return 1;
+            }
+            break;
+          case 'p':
+            switch (argv[i][2]) {
+              case '0':
+                t.SetHugePages(HUGE_PAGES_NONE);
+                break;
+              case 't':
+                t.SetHugePages(HUGE_PAGES_TRANSPARENT);
+                break;
+              case 'e':
+                t.SetHugePages(HUGE_PAGES_EXPLICIT);
+                break;
+              default:
+                PrintUsage();
+                return 1;
+            }
+            break;
+          case 'b':
+            bloom_fp = argv[i][2] ? atof(&argv[i][2]) : 0.01;
+            if (bloom_fp <= 0.0 || bloom_fp >= 1.0) {
+              PrintUsage();
+              return 1;
+            }
+            break;
+          case 'n':
+            replicate = argv[i][2] != '0';
+            break;
+          case 'c':
+            t.SetPathCompression(argv[i][2] != '0');
+            break;
+          case 'i':
+            {
+              int dist = 2, prefix = 7;
+              sscanf(&argv[i][2], "%d,%d", &dist, &prefix);
+              if (dist > 0 && prefix > 0)
+                t.EnableDeletionIndex(dist, prefix);
+            }
+            break;
 
           default:
             PrintUsage();
@@ -280,8 +411,59 @@ int main(int argc, const char *argv[])
     }
   }
 
+  if (loadgen) {
+    DictionaryLoader loader;
+    if (!loader.Load("dict.txt")) {
+      std::cerr << "Error reading dictionary: " << loader.GetError() << std::endl;
+      return 1;
+    }
+    std::vector< std::string > words;
+    for (size_t w = 0; w < loader.GetWordCount(); w++)
+      words.push_back(loader.GetWord(w));
+    LoadGenerator generator(words);
+    return generator.Run(loadgen, connections, depth, requests, ops) ? 0 : 1;
+  }
+
+  // Keep the server's output to the summary unless asked
+  if (serve && !verbose)
+    SET_VERBOSITY_LEVEL(LOG_SILENT);
+
   OutputPreamble();
-  ReadDictionaryFile("dict.txt", &t, pRoot);
+  if (!ReadDictionaryFile("dict.txt", &t, pRoot, sort_mem))
+    return 1;
+  t.SetQueryBudget(budget);
+  if (bloom_fp > 0.0) {
+    t.EnableBloomFilter(bloom_fp);
+    VERBOSE_LOG(LOG_INFO, "Bloom filter: " << t.GetBloomFilter()->GetCount() << " keys, "
+      << (t.GetBloomFilter()->GetBits() >> 13) << " KB, " << t.GetBloomFilter()->GetHashCount() << " hashes." << std::endl);
+  }
+  t.Relayout(layout);
+  pRoot = t.GetRoot();
+
+  if (bench) {
+    RunBenchmark(&t, model, bench);
+    return 0;
+  }
+
+  if (serve) {
+    ReplicaSet replicas(&t, replicate);
+    QueryServer server(&replicas, threads, model);
+    if (!server.Run(serve))
+      return 1;
+    std::cout << "Served " << server.GetServed() << " requests on ";
+    std::cout << server.GetConnections() << " connections." << std::endl;
+    replicas.PrintStats(std::cout);
+    return 0;
+  }
+
+  LayeredDictionary *pLayers = NULL;
+  if (overlay) {
+    pLayers = new LayeredDictionary(&t);
+    if (!pLayers->Load(overlay)) {
+      std::cerr << "Error reading overlay " << overlay << std::endl;
+      return 1;
+    }
+  }
 
   // Print out the top portion of the tree
   if (LOG_DEBUG <= GET_LOG_VERBOSITY())
@@ -290,14 +472,20 @@ int main(int argc, const char *argv[])
   char in[ MAX_IN ];
   while (1) {
     PrintPrompt();
-    std::cin >> in;
+    std::cin.width(MAX_IN);
+    if (!(std::cin >> in))
+      break;
 
     // Extrapolate words from a prefix
     const char *pPrefix = in;
     std::cout << in << "...let's see..." << std::endl;
 
     std::map< int, std::string > extrapolation;
-    t.FuzzyFind(pPrefix, pRoot, &extrapolation);
+    QueryStatus status;
+    if (pLayers)
+      pLayers->FuzzyFindWithModel(model, pPrefix, &extrapolation, &status);
+    else
+      t.FuzzyFindWithModel(model, pPrefix, pRoot, &extrapolation, &status);
 
     if (!extrapolation.empty()) {
       std::cout << "SUGGESTIONS:" << std::endl;
@@ -308,10 +496,15 @@ int main(int argc, const char *argv[])
     } else {
       std::cout << "NO SUGGESTION..." << std::endl;
     }
+    if (status.partial) {
+      std::cout << "(PARTIAL: budget reached after " << status.visits << " nodes, ";
+      std::cout << status.candidates << " candidates)" << std::endl;
+    }
 
     VERBOSE_LOG(LOG_INFO, "MAX TIES: " << t.GetMaxTies() << std::endl);
     t.ClearMaxTies();
 
   }
+  delete pLayers;
   return 0;
 }
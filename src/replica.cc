@@ -0,0 +1,206 @@
+/* Dicto
+ * replica.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "replica.h"
+#include "log.h"
+
+// ReplicaSet
+//
+// @In:     pTree loaded tree; no inserts once replicas exist
+//          replicate true == copy the tree to every NUMA node
+ReplicaSet::ReplicaSet(TernaryTree *pTree, bool replicate)
+{
+  source_ = pTree;
+  numa_nodes_ = 1;
+
+  // Queries share the trees between threads from here on
+  if (source_->GetDeletionIndex())
+    source_->GetDeletionIndex()->Finalize();
+
+  // Map each online NUMA node to its CPUs
+  std::string text;
+  std::vector< int > nodes;
+  std::vector< std::vector< int > > node_cpus;
+  if (ReadFile("/sys/devices/system/node/online", &text) &&
+      ParseCpuList(text.c_str(), &nodes)) {
+    for (auto node : nodes) {
+      char path[ 64 ];
+      std::vector< int > cpus;
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+      if (ReadFile(path, &text) && ParseCpuList(text.c_str(), &cpus) && !cpus.empty())
+        node_cpus.push_back(cpus);   // memory-only nodes get no replica
+    }
+  }
+  numa_nodes_ = node_cpus.empty() ? 1 : (int) node_cpus.size();
+
+  if (!replicate || node_cpus.size() < 2) {
+    replicas_.push_back(source_);
+    VERBOSE_LOG(LOG_INFO, numa_nodes_ << " NUMA node(s); serving from one tree." << std::endl);
+  } else {
+    for (size_t i = 0; i < node_cpus.size(); i++) {
+      TernaryTree *replica = new TernaryTree;
+      BuildReplica(source_, replica, node_cpus[ i ]);
+      replicas_.push_back(replica);
+      for (auto cpu : node_cpus[ i ]) {
+        if (cpu >= (int) cpu_replica_.size())
+          cpu_replica_.resize(cpu + 1, 0);
+        cpu_replica_[ cpu ] = (int) i;
+      }
+    }
+    VERBOSE_LOG(LOG_INFO, "Replicated tree to " << replicas_.size() << " NUMA nodes." << std::endl);
+  }
+
+  counters_ = new Counter[ replicas_.size() ];
+  for (size_t i = 0; i < replicas_.size(); i++)
+    counters_[ i ].served = 0;
+}
+
+// ~ReplicaSet
+ReplicaSet::~ReplicaSet()
+{
+  for (auto replica : replicas_)
+    if (replica != source_)
+      delete replica;
+  delete [] counters_;
+}
+
+// Local
+// Pick the tree for the caller's NUMA node and count the query against it.
+//
+// @In:     -
+// @Out:    tree to query
+//          pReplica index of the replica chosen
+TernaryTree *ReplicaSet::Local(int *pReplica)
+{
+  int replica = 0;
+  if (replicas_.size() > 1) {
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < (int) cpu_replica_.size())
+      replica = cpu_replica_[ cpu ];
+  }
+  counters_[ replica ].served.fetch_add(1, std::memory_order_relaxed);
+  if (pReplica)
+    *pReplica = replica;
+  return replicas_[ replica ];
+}
+
+// PrintStats
+// One line per replica: queries served and node storage.
+//
+// @In:     out stream to print to
+// @Out:    -
+void ReplicaSet::PrintStats(std::ostream &out)
+{
+  for (size_t i = 0; i < replicas_.size(); i++) {
+    TernaryTree *tree = replicas_[ i ];
+    out << "Replica " << i << ": " << counters_[ i ].served << " queries, ";
+    out << tree->GetNodeCount() << " nodes";
+    if (tree->GetArena()) {
+      static const char *backing[] = { "malloc", "transparent huge pages", "huge pages" };
+      out << " on " << backing[ tree->GetHugePages() ];
+    }
+    out << std::endl;
+  }
+}
+
+// BuildReplica
+// Copy the source tree on a thread bound to the given CPUs.
+//
+// @In:     pSource tree to copy
+//          pReplica empty tree to fill
+//          cpus CPUs of the target NUMA node
+// @Out:    -
+void ReplicaSet::BuildReplica(
+    TernaryTree *pSource,
+    TernaryTree *pReplica,
+    const std::vector< int > &cpus)
+{
+  std::thread builder([pSource, pReplica, &cpus] {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+      if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set))
+      VERBOSE_LOG(LOG_INFO, "Could not bind replica builder to its node." << std::endl);
+    pReplica->CopyFrom(*pSource);
+  });
+  builder.join();
+}
+
+// ParseCpuList
+// Parse the kernel's list format, e.g. "0-3,8,10-11".
+//
+// @In:     text list
+// @Out:    true == parsed
+//          cpus numbers appended
+bool ReplicaSet::ParseCpuList(const char *text, std::vector< int > *cpus)
+{
+  const char *p = text;
+  while (*p && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p)
+      return false;
+    long last = first;
+    p = end;
+    if ('-' == *p) {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first)
+        return false;
+      p = end;
+    }
+    for (long cpu = first; cpu <= last; cpu++)
+      cpus->push_back((int) cpu);
+    if (',' == *p)
+      p++;
+  }
+  return true;
+}
+
+// ReadFile
+// Read a small text file, such as a sysfs attribute.
+//
+// @In:     path file to read
+// @Out:    true == read
+//          text file contents
+bool ReplicaSet::ReadFile(const char *path, std::string *text)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  std::stringstream contents;
+  contents << file.rdbuf();
+  *text = contents.str();
+  return true;
+}
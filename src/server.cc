@@ -0,0 +1,618 @@
+/* Dicto
+ * server.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "server.h"
+#include "log.h"
+
+const size_t QueryServer::kMaxLine;
+const size_t QueryServer::kMaxInFlight;
+const size_t QueryServer::kMaxCompletions;
+
+// epoll user data for the two non-connection descriptors
+static const uint64_t kListenId = 0;
+static const uint64_t kWakeId = 1;
+
+// Server stopped by SIGINT/SIGTERM
+static QueryServer *_activeServer = NULL;
+
+static void OnSignal(int)
+{
+  if (_activeServer)
+    _activeServer->Stop();
+}
+
+// ParseAddress
+// Turn "/path/to/socket" or "[127.0.0.1:]port" into a socket address.
+//
+// @In:     address textual address
+// @Out:    true == parsed; sa/len filled in
+static bool ParseAddress(
+    const char *address,
+    struct sockaddr_storage *sa,
+    socklen_t *len)
+{
+  memset(sa, 0, sizeof(*sa));
+  if (strchr(address, '/')) {
+    struct sockaddr_un *sun = (struct sockaddr_un *) sa;
+    if (strlen(address) >= sizeof(sun->sun_path))
+      return false;
+    sun->sun_family = AF_UNIX;
+    strcpy(sun->sun_path, address);
+    *len = sizeof(*sun);
+    return true;
+  }
+
+  struct sockaddr_in *sin = (struct sockaddr_in *) sa;
+  const char *port = strrchr(address, ':');
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (port) {
+    std::string host(address, port - address);
+    if (inet_pton(AF_INET, host.c_str(), &sin->sin_addr) != 1)
+      return false;
+    port++;
+  } else {
+    port = address;
+  }
+  int number = atoi(port);
+  if (number <= 0 || number > 65535)
+    return false;
+  sin->sin_port = htons((uint16_t) number);
+  *len = sizeof(*sin);
+  return true;
+}
+
+// QueryServer
+//
+// @In:     pReplicas loaded tree(s); must not be modified while serving
+//          threads number of worker threads
+//          model cost model letter for fuzzy lookups (see FuzzyFindWithModel)
+QueryServer::QueryServer(ReplicaSet *pReplicas, int threads, char model)
+{
+  replicas_ = pReplicas;
+  threads_ = threads > 0 ? threads : 1;
+  model_ = model;
+  epoll_fd_ = listen_fd_ = wake_fd_ = -1;
+  running_ = false;
+  next_id_ = kWakeId + 1;
+  served_ = 0;
+  connections_ = 0;
+}
+
+// ~QueryServer
+QueryServer::~QueryServer()
+{
+  for (auto &it : conns_) {
+    close(it.second->fd);
+    delete it.second;
+  }
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+  if (wake_fd_ >= 0)
+    close(wake_fd_);
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+  if (!unix_path_.empty())
+    unlink(unix_path_.c_str());
+}
+
+// Listen
+// Open a non-blocking listening socket. A stale Unix socket file at the
+// same path is removed first.
+//
+// @In:     address see class comment
+// @Out:    descriptor, -1 on error (errno set)
+int QueryServer::Listen(const char *address)
+{
+  struct sockaddr_storage sa;
+  socklen_t len;
+  if (!ParseAddress(address, &sa, &len)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (sa.ss_family == AF_UNIX) {
+    unlink(((struct sockaddr_un *) &sa)->sun_path);
+  } else {
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  }
+  if (bind(fd, (struct sockaddr *) &sa, len) < 0 || listen(fd, 128) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+// Connect
+// Open a blocking client connection.
+//
+// @In:     address see class comment
+// @Out:    descriptor, -1 on error (errno set)
+int QueryServer::Connect(const char *address)
+{
+  struct sockaddr_storage sa;
+  socklen_t len;
+  if (!ParseAddress(address, &sa, &len)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *) &sa, len) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  if (sa.ss_family == AF_INET) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+// Run
+// Serve until Stop() or SIGINT/SIGTERM.
+//
+// @In:     address see class comment
+// @Out:    false == could not set up the socket
+bool QueryServer::Run(const char *address)
+{
+  listen_fd_ = Listen(address);
+  if (listen_fd_ < 0) {
+    std::cerr << "Cannot listen on " << address << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  if (strchr(address, '/'))
+    unix_path_ = address;
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    std::cerr << "Cannot set up event loop: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = kListenId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+  ev.data.u64 = kWakeId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+  running_ = true;
+  _activeServer = this;
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  for (int i = 0; i < threads_; i++)
+    workers_.push_back(std::thread(&QueryServer::WorkerLoop, this));
+
+  VERBOSE_LOG(LOG_INFO, "Serving on " << address << " with " << threads_ << " threads." << std::endl);
+
+  const int kMaxEvents = 64;
+  struct epoll_event events[ kMaxEvents ];
+  while (running_) {
+    int n = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[ i ].data.u64;
+      if (id == kListenId) {
+        Accept();
+      } else if (id == kWakeId) {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0) {
+        }
+        DrainReplies();
+      } else {
+        auto it = conns_.find(id);
+        if (it == conns_.end())
+          continue;
+        Connection *conn = it->second;
+        if (events[ i ].events & EPOLLOUT)
+          WriteTo(conn);
+        // WriteTo may have closed it
+        if (conns_.count(id) &&
+            (events[ i ].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+          ReadFrom(conn);
+      }
+    }
+  }
+
+  {
+    std::lock_guard< std::mutex > lock(job_lock_);
+    running_ = false;
+  }
+  job_ready_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+  workers_.clear();
+  _activeServer = NULL;
+  return true;
+}
+
+// Stop
+// Ask the event loop to exit. Safe to call from a signal handler.
+//
+// @In:     -
+// @Out:    -
+void QueryServer::Stop()
+{
+  running_ = false;
+  uint64_t one = 1;
+  if (wake_fd_ >= 0 && write(wake_fd_, &one, sizeof(one)) < 0) {
+    // Already signalled; the loop will see running_
+  }
+}
+
+// Accept
+// Take every pending connection.
+//
+// @In:     -
+// @Out:    -
+void QueryServer::Accept()
+{
+  while (1) {
+    int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    Connection *conn = new Connection;
+    conn->fd = fd;
+    conn->id = next_id_++;
+    conn->next_seq = conn->next_reply = 0;
+    conn->closing = false;
+    conn->events = EPOLLIN;
+    conns_[ conn->id ] = conn;
+    connections_++;
+
+    struct epoll_event ev;
+    ev.events = conn->events;
+    ev.data.u64 = conn->id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    VERBOSE_LOG(LOG_DEBUG, "ACCEPT " << conn->id << std::endl);
+  }
+}
+
+// ReadFrom
+// Read what the peer has sent and hand complete requests to the workers.
+//
+// @In:     conn connection; may be closed and freed on return
+// @Out:    -
+void QueryServer::ReadFrom(Connection *conn)
+{
+  char buf[ 65536 ];
+  std::vector< Job > jobs;
+
+  while (conn->next_seq - conn->next_reply < kMaxInFlight) {
+    ssize_t n = recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      conn->in.append(buf, n);
+      ParseRequests(conn, &jobs);
+      if (conn->closing)
+        break;              // protocol error
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    conn->closing = true;   // EOF or error
+    break;
+  }
+
+  if (!jobs.empty()) {
+    {
+      std::lock_guard< std::mutex > lock(job_lock_);
+      for (auto &job : jobs)
+        jobs_.push_back(std::move(job));
+    }
+    if (jobs.size() > 1)
+      job_ready_.notify_all();
+    else
+      job_ready_.notify_one();
+  }
+
+  // Replies to malformed requests are ready right away
+  WriteTo(conn);
+}
+
+// ParseRequests
+// Split buffered input into requests. Malformed lines are answered with
+// an error in sequence; an over-long line closes the connection.
+//
+// @In:     conn connection with buffered input
+// @Out:    jobs requests to run
+void QueryServer::ParseRequests(Connection *conn, std::vector< Job > *jobs)
+{
+  size_t start = 0, end;
+  while ((end = conn->in.find('\n', start)) != std::string::npos) {
+    size_t len = end - start;
+    if (len && conn->in[ end - 1 ] == '\r')
+      len--;
+
+    uint64_t seq = conn->next_seq++;
+    const char *line = conn->in.data() + start;
+    start = end + 1;
+
+    if (len > kMaxLine) {
+      conn->ready[ seq ] = "E line too long\n";
+      continue;
+    }
+    if (len < 2 || line[ 1 ] != ' ' || !strchr("FZC", line[ 0 ]) ||
+        (len == 2 && line[ 0 ] != 'C')) {
+      conn->ready[ seq ] = "E bad request\n";
+      continue;
+    }
+
+    Job job;
+    job.conn = conn->id;
+    job.seq = seq;
+    job.op = line[ 0 ];
+    job.word.assign(line + 2, len - 2);
+    jobs->push_back(std::move(job));
+  }
+  conn->in.erase(0, start);
+
+  if (conn->in.length() > kMaxLine) {
+    conn->ready[ conn->next_seq++ ] = "E line too long\n";
+    conn->in.clear();
+    conn->closing = true;
+  }
+}
+
+// WorkerLoop
+// Run requests in batches until the server stops.
+//
+// @In:     -
+// @Out:    -
+void QueryServer::WorkerLoop()
+{
+  const size_t kBatch = 64;
+  std::vector< Job > batch;
+  std::vector< Reply > done;
+
+  while (1) {
+    {
+      std::unique_lock< std::mutex > lock(job_lock_);
+      job_ready_.wait(lock, [this] { return !jobs_.empty() || !running_; });
+      if (!running_)
+        return;
+      while (!jobs_.empty() && batch.size() < kBatch) {
+        batch.push_back(std::move(jobs_.front()));
+        jobs_.pop_front();
+      }
+    }
+
+    for (auto &job : batch) {
+      Reply reply;
+      reply.conn = job.conn;
+      reply.seq = job.seq;
+      Execute(job, &reply.text);
+      done.push_back(std::move(reply));
+    }
+    served_ += batch.size();
+    batch.clear();
+
+    {
+      std::lock_guard< std::mutex > lock(reply_lock_);
+      for (auto &reply : done)
+        replies_.push_back(std::move(reply));
+    }
+    done.clear();
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {
+      // Counter saturated; the loop is already awake
+    }
+  }
+}
+
+// Execute
+// Run one request against the tree.
+//
+// @In:     job request
+// @Out:    reply reply line, newline terminated
+void QueryServer::Execute(const Job &job, std::string *reply)
+{
+  int replica;
+  TernaryTree *tree = replicas_->Local(&replica);
+  TNode *root = tree->GetRoot();
+  char num[ 32 ];
+
+  VERBOSE_LOG(LOG_DEBUG, "REPLICA " << replica << " " << job.op << " " << job.word << std::endl);
+
+  switch (job.op) {
+    case 'F':
+      *reply = tree->Find(job.word.c_str(), root) ? "1" : "0";
+      break;
+    case 'Z':
+      {
+        std::map< int, std::string > words;
+        QueryStatus status;
+        tree->FuzzyFindWithModel(model_, job.word.c_str(), root, &words, &status);
+        snprintf(num, sizeof(num), status.partial ? "%zu+" : "%zu", words.size());
+        *reply = num;
+        for (auto &it : words) {
+          snprintf(num, sizeof(num), " %d:", it.first >> 12);
+          *reply += num;
+          *reply += it.second;
+        }
+      }
+      break;
+    case 'C':
+      {
+        std::vector< std::string > words;
+        tree->Complete(job.word.c_str(), root, &words, kMaxCompletions);
+        snprintf(num, sizeof(num), "%zu", words.size());
+        *reply = num;
+        for (auto &word : words) {
+          *reply += ' ';
+          *reply += word;
+        }
+      }
+      break;
+  }
+  *reply += '\n';
+}
+
+// DrainReplies
+// Collect finished replies and send whatever is next in line on each
+// connection.
+//
+// @In:     -
+// @Out:    -
+void QueryServer::DrainReplies()
+{
+  std::vector< Reply > replies;
+  {
+    std::lock_guard< std::mutex > lock(reply_lock_);
+    replies.swap(replies_);
+  }
+
+  std::vector< uint64_t > touched;
+  for (auto &reply : replies) {
+    auto it = conns_.find(reply.conn);
+    if (it == conns_.end())
+      continue;             // connection went away
+    it->second->ready[ reply.seq ] = std::move(reply.text);
+    touched.push_back(reply.conn);
+  }
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+  for (auto id : touched) {
+    auto it = conns_.find(id);
+    if (it != conns_.end())
+      WriteTo(it->second);
+  }
+}
+
+// WriteTo
+// Queue in-order replies and write as much as the socket takes.
+//
+// @In:     conn connection; may be closed and freed on return
+// @Out:    -
+void QueryServer::WriteTo(Connection *conn)
+{
+  auto it = conn->ready.begin();
+  while (it != conn->ready.end() && it->first == conn->next_reply) {
+    conn->out += it->second;
+    conn->next_reply++;
+    it = conn->ready.erase(it);
+  }
+
+  size_t sent = 0;
+  while (sent < conn->out.length()) {
+    ssize_t n = send(conn->fd, conn->out.data() + sent,
+      conn->out.length() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    Close(conn);
+    return;
+  }
+  conn->out.erase(0, sent);
+
+  if (conn->closing && conn->out.empty() && conn->next_reply == conn->next_seq) {
+    Close(conn);
+    return;
+  }
+  UpdateEvents(conn);
+}
+
+// UpdateEvents
+// Register for writes while output is pending, and for reads while the
+// peer is open and under its in-flight limit.
+//
+// @In:     conn connection
+// @Out:    -
+void QueryServer::UpdateEvents(Connection *conn)
+{
+  uint32_t events = 0;
+  if (!conn->closing && conn->next_seq - conn->next_reply < kMaxInFlight)
+    events |= EPOLLIN;
+  if (!conn->out.empty())
+    events |= EPOLLOUT;
+  if (events == conn->events)
+    return;
+
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.u64 = conn->id;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd, &ev);
+  conn->events = events;
+}
+
+// Close
+// Drop a connection. Replies still being computed for it are discarded.
+//
+// @In:     conn connection, freed on return
+// @Out:    -
+void QueryServer::Close(Connection *conn)
+{
+  VERBOSE_LOG(LOG_DEBUG, "CLOSE " << conn->id << std::endl);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  conns_.erase(conn->id);
+  delete conn;
+}
@@ -26,8 +26,10 @@
 
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
+#include <sys/mman.h>
 #include <fstream>
 #include <string>
 #include <map>
@@ -35,6 +37,10 @@
 #include <stack>
 #include <queue>
 #include <deque>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <unordered_map>
 #include "templ_node.h"
 #include "ternary_tree.h"
 #include "log.h"
@@ -48,36 +54,261 @@ typedef unsigned char UCHAR;
 // This is a dictionary and allows us quick word lookup
 // with a yes/no response.
 
+// ~TernaryTree
+TernaryTree::~TernaryTree()
+{
+  // Nodes inserted one at a time live on the heap; the rest are in the
+  // arena, freed below
+  std::stack< TNode * > pending;
+  if (root_)
+    pending.push(root_);
+  while (!pending.empty()) {
+    TNode *node = pending.top();
+    pending.pop();
+    if (node->GetLeft())
+      pending.push(node->GetLeft());
+    if (node->GetCenter())
+      pending.push(node->GetCenter());
+    if (node->GetRight())
+      pending.push(node->GetRight());
+    if (node < arena_ || node >= arena_ + arena_size_)
+      delete node;
+  }
+  delete deletion_index_;
+  delete bloom_;
+  for (int i = 0; i < 256; i++)
+    delete [] root_table2_[ i ];
+  FreeArena(arena_, arena_bytes_);
+}
+
+// Insert
+// Insert a word into the tree and, when the word goes under the tree's
+// own root, the deletion index and Bloom filter. The tree holds the
+// case-folded word; a word inserted with capitals keeps its spelling in
+// the surface table.
+//
+// @In: word pointer to null-terminated UTF-8 string
+// ppParent pointer to parent pointer; NULL inserts under the tree's
+// own root
+// @Out: Node *
+TNode * TernaryTree::Insert(const char *word, TNode **ppNode)
+{
+  std::string folded;
+  const char *key = CaseFolder::Fold(word, &folded);
+  bool rooted = !ppNode || ppNode == &root_;
+  bool cased = rooted && key != word && strcmp(key, word);
+  bool existed = cased && FindKey(key, root_, NULL, NULL);
+
+  if (deletion_index_ && *key && rooted)
+    deletion_index_->Add(key);
+  if (bloom_ && *key && rooted) {
+    uint64_t state = BloomFilter::Start();
+    for (const char *p = key; *p; p++) {
+      state = BloomFilter::Step(state, (UCHAR) *p);
+      bloom_->Add(state);
+    }
+    bloom_->Add(BloomFilter::WordKey(state));
+  }
+
+  TNode *ret;
+  if (!ppNode && root_levels_ && *key)
+    ret = InsertRooted(key);
+  else
+    ret = InsertNode(key, ppNode ? ppNode : &root_);
+  if (*key && (cased || (rooted && !surface_.empty())))
+    AddSurfaceForm(key, word, existed);
+  return ret;
+}
+
+// AddSurfaceForm
+// Record a spelling of a word just inserted under the tree's root. A
+// folded spelling is only recorded for words that already have others.
+//
+// @In: key folded word
+// word spelling as inserted
+// existed the folded word was in the tree before this insert
+// @Out: -
+void TernaryTree::AddSurfaceForm(const char *key, const char *word, bool existed)
+{
+  auto it = surface_.find(key);
+  if (!strcmp(key, word)) {
+    if (it != surface_.end() &&
+        std::find(it->second.begin(), it->second.end(), key) == it->second.end())
+      it->second.push_back(key);
+    return;
+  }
+
+  std::vector< std::string > &forms = surface_[ key ];
+  if (forms.empty() && existed)
+    forms.push_back(key);           // inserted before in folded spelling
+  if (std::find(forms.begin(), forms.end(), word) == forms.end())
+    forms.push_back(word);
+  TNode *node = NULL;
+  if (FindKey(key, root_, &node, NULL) && node)
+    node->SetCased();
+}
+
+// InsertRooted
+// Insert a word under the tree's own root, going through the root table
+// for the first one or two characters.
+//
+// @In: word pointer to non-empty null-terminated string
+// @Out: root node
+TNode * TernaryTree::InsertRooted(const char *word)
+{
+  TNode *pChild;
+  UCHAR c0 = (UCHAR) word[ 0 ];
+  TNode *n1 = root_table_[ c0 ];
+  if (!n1)
+    n1 = root_table_[ c0 ] = InsertKey(word[ 0 ], &root_, NULL);
+  if (!word[ 1 ]) {
+    n1->SetTerminator();
+    return root_;
+  }
+
+  if (root_levels_ < 2) {
+    pChild = InsertNode(word + 1, &(n1->c_));
+    pChild->SetParent(n1);
+    return root_;
+  }
+
+  UCHAR c1 = (UCHAR) word[ 1 ];
+  if (!root_table2_[ c0 ])
+    root_table2_[ c0 ] = new TNode *[ 256 ]();
+  TNode *n2 = root_table2_[ c0 ][ c1 ];
+  if (!n2)
+    n2 = root_table2_[ c0 ][ c1 ] = InsertKey(word[ 1 ], &(n1->c_), n1);
+  if (!word[ 2 ]) {
+    n2->SetTerminator();
+    return root_;
+  }
+
+  pChild = InsertNode(word + 2, &(n2->c_));
+  pChild->SetParent(n2);
+  return root_;
+}
+
+// InsertKey
+// Find or add the node for a single key in one level's sibling tree.
+//
+// @In: key key to find or add
+// ppNode pointer to the level's top node pointer
+// pParent parent shared by every node on this level
+// @Out: node holding key
+TNode * TernaryTree::InsertKey(char key, TNode **ppNode, TNode *pParent)
+{
+  while (*ppNode) {
+    if ((UCHAR) key < (*ppNode)->GetKey())
+      ppNode = &((*ppNode)->l_);
+    else if ((UCHAR) key > (*ppNode)->GetKey())
+      ppNode = &((*ppNode)->r_);
+    else
+      return *ppNode;
+  }
+  *ppNode = AllocNode(key);
+  (*ppNode)->SetParent(pParent);
+  return *ppNode;
+}
+
+// EnableRootTable
+// Switch on the direct-indexed top levels. Words already in the tree are
+// indexed now; later inserts keep the tables current.
+//
+// @In: levels number of character levels to index (0 - 2)
+// @Out: -
+void TernaryTree::EnableRootTable(int levels)
+{
+  root_levels_ = levels < 0 ? 0 : (levels > 2 ? 2 : levels);
+  memset(root_table_, 0, sizeof(root_table_));
+  for (int i = 0; i < 256; i++) {
+    delete [] root_table2_[ i ];
+    root_table2_[ i ] = NULL;
+  }
+  if (root_levels_)
+    IndexRootLevel(root_);
+}
+
+// IndexRootLevel
+// Register every node of the root level, and when two levels are
+// indexed, every node of their center levels.
+//
+// @In: pNode node on the root level
+// @Out: -
+void TernaryTree::IndexRootLevel(TNode *pNode)
+{
+  if (!pNode)
+    return;
+  UCHAR c0 = pNode->GetKey();
+  SplitRun(pNode, 0);
+  root_table_[ c0 ] = pNode;
+  if (root_levels_ > 1 && pNode->GetCenter()) {
+    std::stack< TNode * > pending;
+    if (!root_table2_[ c0 ])
+      root_table2_[ c0 ] = new TNode *[ 256 ]();
+    pending.push(pNode->GetCenter());
+    while (!pending.empty()) {
+      TNode *n2 = pending.top();
+      pending.pop();
+      SplitRun(n2, 0);
+      root_table2_[ c0 ][ n2->GetKey() ] = n2;
+      if (n2->GetLeft())
+        pending.push(n2->GetLeft());
+      if (n2->GetRight())
+        pending.push(n2->GetRight());
+    }
+  }
+  IndexRootLevel(pNode->GetLeft());
+  IndexRootLevel(pNode->GetRight());
+}
+
 // InsertNode
 // Insert a node into the tree
 //
 // @In: word pointer to null-terminated string
 // ppParent pointer to parent pointer
 // @Out: Node *
-TNode * TernaryTree::Insert(const char *word, TNode **ppNode)
+TNode * TernaryTree::InsertNode(const char *word, TNode **ppNode)
 {
   TNode * pChild = NULL;
   VERBOSE_LOG(LOG_DEBUG, "Insert >>>>>" << std::endl);
   if (!(*ppNode)) {
     *ppNode = AllocNode(*word);
+    // A new branch has no siblings below it yet; keep as much of the
+    // word as fits in this node's run
+    if (compress_) {
+      size_t len = strnlen(word + 1, TNode::kMaxTail);
+      (*ppNode)->SetTail(word + 1, (int) len);
+    }
     VERBOSE_LOG(LOG_DEBUG, "ALLOC" << std::endl);
   }
-  if (tolower(*word) < ((*ppNode)->GetKey())) {
+  if ((UCHAR) *word < (*ppNode)->GetKey()) {
     VERBOSE_LOG(LOG_DEBUG,  "L: " << word);
-    Insert(word, &((*ppNode)->l_));
+    InsertNode(word, &((*ppNode)->l_));
     (*ppNode)->GetLeft()->SetParent((*ppNode)->GetParent());
   }
-  else if (tolower(*word) > (*ppNode)->GetKey()) {
+  else if ((UCHAR) *word > (*ppNode)->GetKey()) {
     VERBOSE_LOG(LOG_DEBUG,  "R: " << word << std::endl);
     // Add a peer on the right
-    Insert(word, &((*ppNode)->r_));
+    InsertNode(word, &((*ppNode)->r_));
     (*ppNode)->GetRight()->SetParent((*ppNode)->GetParent());
   } else {
+    // Match the word against the run; split the run where the word ends
+    // or diverges inside it
+    const UCHAR *tail = (*ppNode)->GetTail();
+    int tail_len = (*ppNode)->GetTailLength();
+    int i = 0;
+    while (i < tail_len && word[ 1 + i ] &&
+        (UCHAR) word[ 1 + i ] == tail[ i ])
+      i++;
+    if (i < tail_len)
+      SplitRun(*ppNode, i);
+    word += i;
+
     // Is this the last letter (is there a char in the second position?)
     if (word[ 1 ])
     {
       VERBOSE_LOG(LOG_DEBUG,  "C: " << word << std::endl);
-      pChild = Insert(word + 1, &((*ppNode)->c_));
+      pChild = InsertNode(word + 1, &((*ppNode)->c_));
       pChild->SetParent(*ppNode);
     }
     else
@@ -103,58 +334,239 @@ TNode * TernaryTree::Insert(const char *word, TNode **ppNode)
   return *ppNode;
 };
 
+// SplitRun
+// Cut a node's run after keep tail keys. The rest of the run moves to a
+// new center child, which takes over the terminator and the level below.
+//
+// @In: pNode node to split
+// keep number of tail keys to leave in pNode
+// @Out: -
+void TernaryTree::SplitRun(TNode *pNode, int keep)
+{
+  int tail_len = pNode->GetTailLength();
+  if (keep >= tail_len)
+    return;
+
+  TNode *child = AllocNode(pNode->GetTail()[ keep ]);
+  child->SetTail((const char *) pNode->GetTail() + keep + 1, tail_len - keep - 1);
+  if (pNode->GetTerminator())
+    child->SetTerminator();
+  if (pNode->GetCased())
+    child->SetCased();
+  child->SetCenter(pNode->GetCenter());
+  child->SetParent(pNode);
+
+  // Every node on the level below shares the moved run as its parent
+  std::stack< TNode * > pending;
+  if (child->GetCenter())
+    pending.push(child->GetCenter());
+  while (!pending.empty()) {
+    TNode *sibling = pending.top();
+    pending.pop();
+    sibling->SetParent(child);
+    if (sibling->GetLeft())
+      pending.push(sibling->GetLeft());
+    if (sibling->GetRight())
+      pending.push(sibling->GetRight());
+  }
+
+  pNode->SetCenter(child);
+  pNode->SetTailLength(keep);
+  pNode->terminator_ = 0;
+  pNode->cased_ = 0;
+}
+
 // Find
-// Find a word
+// Find a word, ignoring case. The word is folded once here; the walk
+// itself compares bytes.
 //
-// @In:     @word pointer to null-terminated string
+// @In:     @word pointer to null-terminated UTF-8 string
 //          @pParent pointer to current parent node
 //          @ppTerminal pointer to terminal node pointer
+//          @pRunOffset tail keys of *ppTerminal matched by the word
 // @Out:    true == match found
-bool TernaryTree::Find(const char *word, TNode *pParent, TNode ** ppTerminal)
+bool TernaryTree::Find(
+    const char *word,
+    TNode *pParent,
+    TNode ** ppTerminal,
+    int *pRunOffset)
+{
+  std::string folded;
+  word = CaseFolder::Fold(word, &folded);
+  if (pParent && pParent == root_ && bloom_ && !ppTerminal &&
+      !bloom_->MayContain(BloomFilter::WordKey(word)))
+    return false;                 // certainly not a word
+  return FindKey(word, pParent, ppTerminal, pRunOffset);
+}
+
+// FindKey
+// Find a folded word
+//
+// Runs in compressed nodes are compared in one tight loop. When the word
+// ends inside a run, the node is still reported through ppTerminal, with
+// pRunOffset telling how many of its tail keys the word covered.
+// A fuzzy lookup's stem search passes its context, so every node entered
+// is charged to the query budget; once it is spent nothing is found.
+//
+// @In:     @word pointer to null-terminated, folded string
+//          @pParent pointer to current parent node
+//          @ppTerminal pointer to terminal node pointer
+//          @pRunOffset tail keys of *ppTerminal matched by the word
+//          @ctx fuzzy lookup to charge, may be NULL
+// @Out:    true == match found
+bool TernaryTree::FindKey(
+    const char *word,
+    TNode *pParent,
+    TNode ** ppTerminal,
+    int *pRunOffset,
+    ExtrapolateContext *ctx)
 {
   bool ret = false;
-  if (pParent)
+  if (pParent && pParent == root_ && root_levels_ && *word)
+    ret = FindRooted(word, ppTerminal, pRunOffset, ctx);
+  else if (pParent && ctx && !ctx->Visit())
+    ret = false;
+  else if (pParent)
   {
-    if ((*word) < pParent->GetKey())
-      ret = Find(word, pParent->GetLeft(), ppTerminal);
-    else if ((*word) > pParent->GetKey())
-      ret = Find(word, pParent->GetRight(), ppTerminal);
+    if ((UCHAR) *word < pParent->GetKey())
+      ret = FindKey(word, pParent->GetLeft(), ppTerminal, pRunOffset, ctx);
+    else if ((UCHAR) *word > pParent->GetKey())
+      ret = FindKey(word, pParent->GetRight(), ppTerminal, pRunOffset, ctx);
     else
     {
-      if ('\0' == word[ 1 ])
+      const UCHAR *tail = pParent->GetTail();
+      int tail_len = pParent->GetTailLength();
+      int len = 0;
+      while (len < tail_len && (UCHAR) word[ 1 + len ] == tail[ len ])
+        len++;
+      if (len < tail_len && word[ 1 + len ])
+        ret = false;                // diverged inside the run
+      else if (len < tail_len || '\0' == word[ 1 + len ])
       {
-        ret = pParent->GetTerminator();
+        // Only the end of a run can be a terminator
+        ret = len == tail_len && pParent->GetTerminator();
         if (ppTerminal) // Mark pointer to node
           *ppTerminal = pParent;
+        if (pRunOffset)
+          *pRunOffset = len;
       }
       else
-        ret = Find(word + 1, pParent->GetCenter(), ppTerminal);
+        ret = FindKey(word + 1 + len, pParent->GetCenter(), ppTerminal, pRunOffset, ctx);
     }
   }
   return ret;
 }
 
+// FindRooted
+// Find a word from the tree's own root, jumping through the root table
+// for the first one or two characters.
+//
+// @In:     @word pointer to non-empty null-terminated string
+//          @ppTerminal pointer to terminal node pointer
+//          @ctx fuzzy lookup to charge, may be NULL
+// @Out:    true == match found
+bool TernaryTree::FindRooted(
+    const char *word,
+    TNode ** ppTerminal,
+    int *pRunOffset,
+    ExtrapolateContext *ctx)
+{
+  TNode *node = root_table_[ (UCHAR) word[ 0 ] ];
+  if (!node || (ctx && !ctx->Visit()))
+    return false;
+  if (root_levels_ > 1 && word[ 1 ]) {
+    TNode **row = root_table2_[ (UCHAR) word[ 0 ] ];
+    node = row ? row[ (UCHAR) word[ 1 ] ] : NULL;
+    if (!node || (ctx && !ctx->Visit()))
+      return false;
+    word++;
+  }
+
+  // Table nodes are never compressed
+  if ('\0' == word[ 1 ]) {
+    if (ppTerminal) // Mark pointer to node
+      *ppTerminal = node;
+    if (pRunOffset)
+      *pRunOffset = 0;
+    return node->GetTerminator();
+  }
+  return FindKey(word + 1, node->GetCenter(), ppTerminal, pRunOffset, ctx);
+}
+
 // Perform an inexact, "fuzzy" lookup of a word
+// max_diff_ is in full edits and is scaled by the cost model's unit.
+// The word is case folded once and scored against folded keys; the
+// results carry the words' surface forms.
+// The work done is limited by pBudget, or the tree's default budget;
+// when a limit is reached the words scored so far are returned and
+// pStatus is flagged partial.
+// A caller merging several trees can pin the stem with stem_len, so every
+// tree extrapolates from the same prefix of the (folded) word; a tree
+// without that prefix adds nothing. The deletion index ignores it.
 //
 // @In:     @word pointer to null-terminated string
 //          @pParent pointer to current parent node
+//          @pBudget work limits, NULL == the tree's (see SetQueryBudget)
+//          @stem_len length of the folded word's stem, SIZE_MAX == the
+//          longest prefix in the tree
 // @Out:    true == match found
 //          @map key/value pair map with tiebroken score and word
+//          @pStatus work done and partial flag, may be NULL
+template <class Model>
 void TernaryTree::FuzzyFind(
     const char *word,
     TNode *pParent,
-    std::map< int, std::string > *words)
+    std::map< int, std::string > *words,
+    QueryStatus *pStatus,
+    const QueryBudget *pBudget,
+    size_t stem_len)
 {
+  if (!pBudget)
+    pBudget = &budget_;
+  if (pStatus)
+    *pStatus = QueryStatus();
+  std::string folded;
+  word = CaseFolder::Fold(word, &folded);
+
+  // Small distances are answered from the deletion index when we have one.
+  // The index is exact for as many edits as the budget can pay for. It
+  // only holds words under root_; other roots are walked.
+  if (deletion_index_ && pParent == root_ && max_diff_ > 0 &&
+      max_diff_ * Model::kUnit / Model::kMinEdit <=
+        deletion_index_->GetMaxDistance()) {
+    IndexFind<Model>(word, words, pStatus, *pBudget);
+    return;
+  }
+
+  // One context covers the whole query: the stem search is charged to
+  // the budget as well as the walk below it
+  ExtrapolateContext ctx(word, word, 0, 0, false, words, *pBudget);
+
+  // The filter bounds the longest prefix in the tree, so the stem search
+  // can skip lengths that are certainly absent
   std::string search_word = word;
+  if (bloom_ && pParent == root_)
+    search_word.resize(GetBloomPrefix(word));
+  if (stem_len != SIZE_MAX) {
+    if (search_word.length() < stem_len)
+      return;                     // the pinned stem is certainly absent
+    search_word.resize(stem_len);
+  }
   TNode *node = NULL;
+  int run_offset = 0;
   while (search_word.length() > 0)
   {
     VERBOSE_LOG(LOG_INFO,  "SEARCHING " << search_word.c_str() << "(" << word << ")" << std::endl);
-    if (Find(search_word.c_str(), pParent, &node)) {
-      (*words)[0] = search_word.c_str();
+    if (FindKey(search_word.c_str(), pParent, &node, &run_offset, &ctx)) {
+      // Every spelling of the word scores 0
+      auto it = node->GetCased() ? surface_.find(search_word) : surface_.end();
+      if (it == surface_.end())
+        (*words)[0] = search_word;
+      for (size_t i = 0; it != surface_.end() && i < it->second.size(); i++)
+        (*words)[ (int) i ] = it->second[ i ];
       break;
     }
-    if (node)
+    if (node || ctx.stopped || stem_len != SIZE_MAX)
       break;
 
     VERBOSE_LOG(LOG_INFO,  "NO \"" << search_word.c_str() << "\" found; ");
@@ -170,11 +582,201 @@ void TernaryTree::FuzzyFind(
     if (word != search_word) {
       VERBOSE_LOG(LOG_NONE,  "NO EXACT MATCH; NEAREST STEM: " << search_word.c_str() << "(ORIGINAL: " << word << ")" << std::endl);
     }
+    // A stem ending inside a compressed run can only continue with the
+    // rest of the run; extend it, and score the run's own word as well.
+    bool partial = run_offset < node->GetTailLength();
+    if (partial) {
+      search_word.append((const char *) node->GetTail() + run_offset,
+        node->GetTailLength() - run_offset);
+    }
     VERBOSE_LOG(LOG_INFO,  "TRYING " << search_word.c_str() << "(" << word << ")" << std::endl);
-    ExtrapolateAll(node, words, &accum, search_word.c_str(), word);
+    ctx.stem = search_word.c_str();
+    ExtrapolateStem<Model>(node, &accum, partial && node->GetTerminator(), &ctx);
+  }
+  ctx.status.partial = ctx.stopped;
+  if (pStatus)
+    *pStatus = ctx.status;
+}
+
+// FuzzyFindWithModel
+// FuzzyFind with the cost model picked at run time by its letter:
+// u Levenshtein, d Damerau, c case-insensitive, k keyboard distance.
+//
+// @In:     @model cost model letter
+//          @word pointer to null-terminated string
+//          @pParent pointer to current parent node
+//          @pBudget work limits, NULL == the tree's
+//          @stem_len length of the folded word's stem (see FuzzyFind)
+// @Out:    @map key/value pair map with tiebroken score and word
+//          @pStatus work done and partial flag, may be NULL
+void TernaryTree::FuzzyFindWithModel(
+    char model,
+    const char *word,
+    TNode *pParent,
+    std::map< int, std::string > *words,
+    QueryStatus *pStatus,
+    const QueryBudget *pBudget,
+    size_t stem_len)
+{
+  switch (model) {
+    case 'd':
+      FuzzyFind<DamerauCost>(word, pParent, words, pStatus, pBudget, stem_len);
+      break;
+    case 'c':
+      FuzzyFind<CaseFoldCost>(word, pParent, words, pStatus, pBudget, stem_len);
+      break;
+    case 'k':
+      FuzzyFind<KeyboardCost>(word, pParent, words, pStatus, pBudget, stem_len);
+      break;
+    default:
+      FuzzyFind<UnitCost>(word, pParent, words, pStatus, pBudget, stem_len);
+      break;
   }
 }
 
+// Complete
+// List the words beginning with a prefix, in the order of their folded
+// spellings. Case is ignored in the prefix.
+//
+// @In:     @prefix pointer to null-terminated prefix; "" lists everything
+//          @pParent pointer to current parent node
+//          @limit most words to return
+// @Out:    number of words added
+//          @words filled with completions
+size_t TernaryTree::Complete(
+    const char *prefix,
+    TNode *pParent,
+    std::vector< std::string > *words,
+    size_t limit)
+{
+  size_t start = words->size();
+  limit = limit > SIZE_MAX - start ? SIZE_MAX : limit + start;
+  std::string folded;
+  prefix = CaseFolder::Fold(prefix, &folded);
+  std::string stem = prefix;
+  if (!*prefix) {
+    CollectWords(pParent, &stem, words, limit);
+    return words->size() - start;
+  }
+
+  TNode *node = NULL;
+  int run_offset = 0;
+  FindKey(prefix, pParent, &node, &run_offset);
+  if (!node)
+    return 0;
+
+  // Finish the run the prefix ended in
+  stem.append((const char *) node->GetTail() + run_offset,
+    node->GetTailLength() - run_offset);
+  if (node->GetTerminator())
+    AddSurfaceForms(node, stem, words, limit);
+  CollectWords(node->GetCenter(), &stem, words, limit);
+  return words->size() - start;
+}
+
+// CollectWords
+// In-order walk adding every word under a node.
+//
+// @In:     @pNode node to start from (and its siblings)
+//          @prefix keys above pNode; restored on return
+//          @limit stop once words holds this many
+// @Out:    @words filled with words
+void TernaryTree::CollectWords(
+    TNode *node,
+    std::string *prefix,
+    std::vector< std::string > *words,
+    size_t limit)
+{
+  if (!node || words->size() >= limit)
+    return;
+
+  CollectWords(node->GetLeft(), prefix, words, limit);
+
+  size_t len = prefix->length();
+  prefix->push_back((char) node->GetKey());
+  prefix->append((const char *) node->GetTail(), node->GetTailLength());
+  if (node->GetTerminator())
+    AddSurfaceForms(node, *prefix, words, limit);
+  CollectWords(node->GetCenter(), prefix, words, limit);
+  prefix->resize(len);
+
+  CollectWords(node->GetRight(), prefix, words, limit);
+}
+
+// AddSurfaceForms
+// Add the spellings of the word ending at a terminal node: the folded
+// word itself unless the node is flagged cased.
+//
+// @In:     @pNode terminal node
+//          @key folded word
+//          @limit stop once words holds this many
+// @Out:    @words filled with words
+void TernaryTree::AddSurfaceForms(
+    TNode *node,
+    const std::string &key,
+    std::vector< std::string > *words,
+    size_t limit)
+{
+  auto it = node->GetCased() ? surface_.find(key) : surface_.end();
+  if (it == surface_.end()) {
+    if (words->size() < limit)
+      words->push_back(key);
+    return;
+  }
+  for (size_t i = 0; i < it->second.size() && words->size() < limit; i++)
+    words->push_back(it->second[ i ]);
+}
+
+// IndexFind
+// Perform a fuzzy lookup through the deletion index: gather candidates
+// sharing a deletion variant with the word, then keep those whose real
+// distance under the cost model is within max_diff_.
+//
+// @In:     @word pointer to null-terminated, folded string
+//          @limits work limits; visits count index candidates
+// @Out:    @words key/value pair map with tiebroken score and word
+//          @pStatus work done and partial flag, may be NULL
+template <class Model>
+void TernaryTree::IndexFind(
+    const char *word,
+    std::map< int, std::string > *words,
+    QueryStatus *pStatus,
+    const QueryBudget &limits)
+{
+  ExtrapolateContext ctx(word, word, 0, 0, false, words, limits);
+  std::vector< uint32_t > ids;
+  std::map< int, int > tie_breaker_lookup;
+  std::set< std::string > seen;   // spellings of one word share a key
+  int budget = max_diff_ * Model::kUnit;
+  deletion_index_->Lookup(word, budget / Model::kMinEdit, &ids);
+  VERBOSE_LOG(LOG_INFO, "INDEX CANDIDATES: " << ids.size() << std::endl);
+
+  for (auto id : ids) {
+    if (!ctx.Visit() || !ctx.Candidate())
+      break;
+    const std::string &candidate = deletion_index_->GetWord(id);
+    int score = CalcDistance<Model>(word, candidate.c_str());
+    if (score <= budget && seen.insert(candidate).second)
+      AddScoredWord(words, &tie_breaker_lookup, score, candidate);
+  }
+  ctx.status.partial = ctx.stopped;
+  if (pStatus)
+    *pStatus = ctx.status;
+}
+
+// EnableDeletionIndex
+// Build a deletion index alongside the tree. Must be called before
+// words are inserted; words already in the tree are not indexed.
+//
+// @In:     max_distance largest distance served from the index
+//          prefix_len number of leading characters indexed per word
+// @Out:    -
+void TernaryTree::EnableDeletionIndex(int max_distance, int prefix_len)
+{
+  delete deletion_index_;
+  deletion_index_ = new DeletionIndex(max_distance, prefix_len);
+}
+
 // ExtrapolateAll
 // Extrapolate all possibilities from an input string.
 //
@@ -182,24 +784,67 @@ void TernaryTree::FuzzyFind(
 //        words vector of words
 //        associative map of words
 //        accumulator
+//        score_node the stem itself is a word ending at node
+//        pBudget work limits, NULL == the tree's
 // @Out:  at least one match found
 //        words filled with words from starting node
+//        pStatus work done and partial flag, may be NULL
+template <class Model>
 bool TernaryTree::ExtrapolateAll(
     TNode *node,
     std::map< int, std::string > *words,
     std::deque< UCHAR > *accum,
     const char *stem,
-    const char *word)
+    const char *word,
+    bool score_node,
+    QueryStatus *pStatus,
+    const QueryBudget *pBudget)
 {
-  std::map<int,int> tie_breaker_lookup;
   if (node) {
-    Extrapolate(node, node->GetCenter(), words, accum, stem, word, &tie_breaker_lookup, max_diff_);
+    ExtrapolateContext ctx(stem, word, 0, 0, false, words,
+      pBudget ? *pBudget : budget_);
+    ExtrapolateStem<Model>(node, accum, score_node, &ctx);
+    ctx.status.partial = ctx.stopped;
+    if (pStatus)
+      *pStatus = ctx.status;
     return true;
   }
   else
     return false;
 }
 
+// ExtrapolateStem
+// Set a query's bounds for the cost model and extrapolate from its stem.
+// The context's budget may already be partly spent.
+//
+// @In:     node node the stem ends at
+//          accum accumulator
+//          score_node the stem itself is a word ending at node
+//          ctx per-query state; stem and word set
+// @Out:    ctx words filled, status updated
+template <class Model>
+void TernaryTree::ExtrapolateStem(
+    TNode *node,
+    std::deque< UCHAR > *accum,
+    bool score_node,
+    ExtrapolateContext *ctx)
+{
+  // Each character past the query length costs at least kMinIndel
+  int budget = max_diff_ * Model::kUnit;
+  ctx->max_diff = budget;
+  ctx->max_depth = budget ?
+    (int) (strlen(ctx->word) + budget / Model::kMinIndel - strlen(ctx->stem)) : INT_MAX;
+  ctx->batching = Model::kBatchable;
+  if (score_node) {
+    int score = CalcDistance<Model>(ctx->word, ctx->stem);
+    if (!budget || score <= budget)
+      AddScoredWord(ctx->words, &ctx->tie_breaker_lookup, score, ctx->stem);
+  }
+  Extrapolate<Model>(node, node->GetCenter(), accum, ctx);
+  // Candidates already queued are scored even when the budget ran out
+  ScoreBatch(ctx);
+}
+
 // Extrapolate
 // Extrapolate from a word stem.
 //
@@ -208,35 +853,57 @@ bool TernaryTree::ExtrapolateAll(
 // while a deque gives me both FIFO representation and FILO
 // functionality.
 //
+// Terminals are not scored here; they are queued on the context's batch
+// scorer and scored a batch at a time. Since a score is not known while
+// walking, the only pruning is by length: every character past
+// strlen(word) + max_diff costs at least one insert/delete under the
+// cost model, so deeper center descents can't produce a match. Models
+// the batch scorer doesn't implement are scored directly.
+//
+// Every node entered is charged to the query budget; once it is spent
+// the walk unwinds without entering more.
+//
 // @In:     node pointer to starting node
-//          words map of words, keyed by score
+//          ctx per-query state; words map of words, keyed by score
+//          depth number of keys between the stem and this node
 // @Out:    true == match found
 //          pVect filled with words from starting node
+template <class Model>
 bool TernaryTree::Extrapolate(
     TNode *root,
     TNode *node,
-    std::map< int, std::string > *words,
     std::deque< UCHAR > *accum,
-    const char *stem,
-    const char *word,
-    std::map< int, int > *tie_breaker_lookup,
-    const int max_diff,
+    ExtrapolateContext *ctx,
     int depth
     )
 {
-  if (!node)
+  if (!node || depth >= ctx->max_depth || !ctx->Visit())
     return false;
 
   TNode *pChild = NULL;
   bool ret = false;
+  // Depth of the last key in this node's run; past the bound, neither
+  // this word nor anything under it can match, but siblings still might
+  int end_depth = depth + 1 + node->GetTailLength();
+  bool in_reach = end_depth <= ctx->max_depth;
+
+  // A run's own word comes after the left siblings of its first key, as
+  // it did when every key had a node of its own
+  bool run = node->GetTailLength() > 0;
+  if (run && (pChild = node->GetLeft())) {
+    if (Extrapolate<Model>(root, pChild, accum, ctx, depth))
+      ret |= true;
+  }
 
   // Is this the end of a full word, ergo "o" in "piano"?
-  if (node->GetTerminator()) {
+  if (node->GetTerminator() && in_reach && ctx->Candidate()) {
     VERBOSE_LOG(LOG_DEBUG,  "TERMINATOR: " << node << std::endl);
     std::string search_word;
     TNode *pCur = node;
     while (pCur != root && pCur) {
-      // Push this node's key onto our candidate accumulator
+      // Push this node's keys onto our candidate accumulator
+      for (int i = pCur->GetTailLength() - 1; i >= 0; i--)
+        accum->push_front(pCur->GetTail()[ i ]);
       accum->push_front(pCur->GetKey());
       pCur = pCur->GetParent();
     }
@@ -250,51 +917,24 @@ bool TernaryTree::Extrapolate(
     VERBOSE_LOG(LOG_DEBUG,  std::endl);
 
     std::string compound;
-    compound = stem;
-    compound = compound.substr(0, compound.length());
+    compound = ctx->stem;
     compound += search_word;
     VERBOSE_LOG(LOG_DEBUG,  "ADDING " << compound.c_str() << std::endl);
 
-    int score = CalcLevenshtein(word, compound.c_str());
-
-    // If the Levenshtein distance exceeds our variance threshold,
-    // discontinue and unwind.
-    if (max_diff && score > max_diff) {
-      accum->clear();
-      return false;
+    // Queue for batch scoring; score directly whatever the batch can't take
+    if (!ctx->batching || !ctx->batch.Add(compound)) {
+      int score = CalcDistance<Model>(ctx->word, compound.c_str());
+      if (!ctx->max_diff || score <= ctx->max_diff)
+        AddScoredWord(ctx->words, &ctx->tie_breaker_lookup, score, compound);
     }
-
-    // Is this the first search_word with this levenshtein distance from the stem?
-    // If so populate the key.  If not, use the current tie count.
-    // We will keep a lookup table keyed by score containing the total #
-    // of items with this score.
-    // This operation is faster than the previous O ( (n^2) / 2 + n/2 ) of
-    // iterating through words->count(tie_breaker + (score << shift)) until
-    // we find an empty spot.
-    // Note: limit of 4096 ties!
-    int tie_breaker = 0;
-    if (!((*tie_breaker_lookup).count(score))) {
-      // Set this score-keyed lookup entry to the next distance to use
-      (*tie_breaker_lookup)[ score ] = 0;
-    } else {
-      (*tie_breaker_lookup)[ score ] = (*tie_breaker_lookup)[ score ] + 1;
-      tie_breaker = (*tie_breaker_lookup)[ score ];
-      if( tie_breaker > tie_hwm_ ) {   // update tie high-watermark
-        tie_hwm_ = tie_breaker;
-      }
-    }
-
-    //while ((words)->count(tie_breaker + (score << 12)) != 0) {
-    //  tie_breaker++;
-    //}
-    (*words)[ tie_breaker + (score << 12)] = compound;
-    VERBOSE_LOG(LOG_DEBUG,  "SCORING " << word << " =|= " << compound.c_str() << " SCORE: " << score << std::endl);
+    if (ctx->batch.IsFull())
+      ScoreBatch(ctx);
     accum->clear();
   }
 
   // Recurse
-  if ((pChild = node->GetLeft())) {
-    if (Extrapolate(root, pChild, words, accum, stem, word, tie_breaker_lookup, max_diff, depth + 1)) {
+  if (!run && (pChild = node->GetLeft())) {
+    if (Extrapolate<Model>(root, pChild, accum, ctx, depth)) {
       ret |= true;
       if (!accum->empty() &&
           !pChild->GetLeft() && !pChild->GetCenter() && !pChild->GetRight())
@@ -303,8 +943,8 @@ bool TernaryTree::Extrapolate(
     }
   }
 
-  if ((pChild = node->GetCenter())) {
-    if (Extrapolate(root, pChild, words, accum, stem, word, tie_breaker_lookup, max_diff, depth + 1)) {
+  if (in_reach && (pChild = node->GetCenter())) {
+    if (Extrapolate<Model>(root, pChild, accum, ctx, end_depth)) {
       ret |= true;
       if ((!accum->empty() &&
             !pChild->GetLeft() && !pChild->GetCenter() && !pChild->GetRight())) {
@@ -313,7 +953,7 @@ bool TernaryTree::Extrapolate(
   }
 
   if ((pChild = node->GetRight())) {
-    if (Extrapolate(root, pChild, words, accum, stem, word, tie_breaker_lookup, max_diff, depth + 1)) {
+    if (Extrapolate<Model>(root, pChild, accum, ctx, depth)) {
       ret |= true;
       if ((!accum->empty() &&
             !pChild->GetLeft() && !pChild->GetCenter() && !pChild->GetRight())) {
@@ -324,6 +964,82 @@ bool TernaryTree::Extrapolate(
   return ret;
 }
 
+// ScoreBatch
+// Score the queued candidates and record those within max_diff.
+//
+// @In:     ctx per-query state holding the batch
+// @Out:    -
+void TernaryTree::ScoreBatch(ExtrapolateContext *ctx)
+{
+  int scores[ BatchScorer::kLanes ];
+  if (ctx->batch.IsEmpty())
+    return;
+
+  ctx->batch.Score(scores);
+  for (int k = 0; k < ctx->batch.GetCount(); k++) {
+    if (ctx->max_diff && scores[ k ] > ctx->max_diff)
+      continue;
+    AddScoredWord(ctx->words, &ctx->tie_breaker_lookup, scores[ k ],
+      ctx->batch.GetCandidate(k));
+    VERBOSE_LOG(LOG_DEBUG,  "SCORING " << ctx->word << " =|= " << ctx->batch.GetCandidate(k) << " SCORE: " << scores[ k ] << std::endl);
+  }
+  ctx->batch.Clear();
+}
+
+// AddScoredWord
+// Record a scored word in the result map, keyed by score and tie count.
+//
+// Is this the first word with this levenshtein distance from the stem?
+// If so populate the key.  If not, use the current tie count.
+// We will keep a lookup table keyed by score containing the total #
+// of items with this score.
+// This operation is faster than the previous O ( (n^2) / 2 + n/2 ) of
+// iterating through words->count(tie_breaker + (score << shift)) until
+// we find an empty spot.
+// Note: limit of 4096 ties!
+//
+// A word with surface forms is recorded once per form, all with the
+// word's score.
+//
+// @In:     words map of words, keyed by score
+//          tie_breaker_lookup per-score tie counts
+//          score distance of word from the query
+//          word folded word to record
+// @Out:    -
+void TernaryTree::AddScoredWord(
+    std::map< int, std::string > *words,
+    std::map< int, int > *tie_breaker_lookup,
+    int score,
+    const std::string &word)
+{
+  const std::string *forms = &word;
+  size_t count = 1;
+  if (!surface_.empty()) {
+    auto it = surface_.find(word);
+    if (it != surface_.end()) {
+      forms = it->second.data();
+      count = it->second.size();
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    int tie_breaker = 0;
+    if (!((*tie_breaker_lookup).count(score))) {
+      // Set this score-keyed lookup entry to the next distance to use
+      (*tie_breaker_lookup)[ score ] = 0;
+    } else {
+      (*tie_breaker_lookup)[ score ] = (*tie_breaker_lookup)[ score ] + 1;
+      tie_breaker = (*tie_breaker_lookup)[ score ];
+      int hwm = tie_hwm_.load(std::memory_order_relaxed);
+      while (tie_breaker > hwm &&    // update tie high-watermark
+          !tie_hwm_.compare_exchange_weak(hwm, tie_breaker)) {
+      }
+    }
+
+    (*words)[ tie_breaker + (score << 12)] = forms[ i ];
+  }
+}
+
 // AllocNode
 // Insert a node into the tree
 //
@@ -333,20 +1049,376 @@ TNode *TernaryTree::AllocNode(char key)
 {
   TNode *node = new TNode(key);
   assert(node);
+  node_count_++;
   node->SetKey(key);
   return node;
 }
 
-// Utility preprocessor macro for Levenshtein
-#if !defined(MIN3)
-#define MIN3(a, b, c) ((a) < (b) ? ((a) < (c) ? (a) : (c)) : ((b) < (c) ? (b) : (c)))
-#else
-#error MIN3 Already defined!
-#endif
+// Relayout
+// Copy the tree into one contiguous arena in lookup order: the top
+// hot_levels levels breadth-first, so every query's first hops share a
+// few cache lines, then each subtree below them packed by layout. Node
+// and root table pointers are rewritten; pointers to nodes held outside
+// the tree (GetRoot() results included) must be fetched again.
+//
+// @In: layout order for the subtrees below the hot levels
+// hot_levels node levels (counting l/c/r hops) laid out breadth-first
+// @Out: -
+void TernaryTree::Relayout(LAYOUT layout, int hot_levels)
+{
+  if (!root_ || LAYOUT_NONE == layout)
+    return;
+
+  std::vector< TNode * > order;
+  GetLayoutOrder(layout, hot_levels, &order);
+
+  TNode *old_arena = arena_;
+  size_t old_size = arena_size_;
+  size_t old_bytes = arena_bytes_;
+  CopyNodes(order, *this);
+
+  // Release the old copies: individually allocated nodes, then any
+  // previous arena
+  for (auto node : order)
+    if (node < old_arena || node >= old_arena + old_size)
+      delete node;
+  FreeArena(old_arena, old_bytes);
+}
+
+// EnableBloomFilter
+// Build the prefix/word filter from the tree's contents, sized for them
+// at the given false-positive rate. Later inserts are added as they come
+// but push the rate up once they outnumber the original keys.
+//
+// @In: fp_rate false-positive rate, e.g. 0.01
+// @Out: -
+void TernaryTree::EnableBloomFilter(double fp_rate)
+{
+  delete bloom_;
+  bloom_ = new BloomFilter(CountBloomKeys(root_), fp_rate);
+  AddToBloom(root_, BloomFilter::Start());
+}
+
+// CountBloomKeys
+// Distinct prefixes (one per key, run keys included) plus words.
+//
+// @In: pNode subtree root
+// @Out: number of filter keys in the subtree
+size_t TernaryTree::CountBloomKeys(TNode *pNode)
+{
+  if (!pNode)
+    return 0;
+  return 1 + pNode->GetTailLength() + (pNode->GetTerminator() ? 1 : 0) +
+    CountBloomKeys(pNode->GetLeft()) +
+    CountBloomKeys(pNode->GetCenter()) +
+    CountBloomKeys(pNode->GetRight());
+}
+
+// AddToBloom
+// Add the prefixes and words of a subtree.
+//
+// @In: pNode subtree root
+// state filter hash of the keys above pNode's level
+// @Out: -
+void TernaryTree::AddToBloom(TNode *pNode, uint64_t state)
+{
+  if (!pNode)
+    return;
+  AddToBloom(pNode->GetLeft(), state);
+  AddToBloom(pNode->GetRight(), state);
+
+  state = BloomFilter::Step(state, pNode->GetKey());
+  bloom_->Add(state);
+  for (int i = 0; i < pNode->GetTailLength(); i++) {
+    state = BloomFilter::Step(state, pNode->GetTail()[ i ]);
+    bloom_->Add(state);
+  }
+  if (pNode->GetTerminator())
+    bloom_->Add(BloomFilter::WordKey(state));
+  AddToBloom(pNode->GetCenter(), state);
+}
+
+// GetBloomPrefix
+// Ask the filter how much of a word can be in the tree. The filter holds
+// case-folded keys, and Find and FuzzyFind fold before asking, so the
+// bytes seen here are already folded.
+//
+// @In: pWord pointer to null-terminated string
+// @Out: length of the longest prefix the filter may hold; longer
+// prefixes are certainly absent
+size_t TernaryTree::GetBloomPrefix(const char *word)
+{
+  uint64_t state = BloomFilter::Start();
+  size_t len = 0;
+  while (word[ len ]) {
+    uint64_t next = BloomFilter::Step(state, (UCHAR) word[ len ]);
+    if (!bloom_->MayContain(next))
+      break;
+    state = next;
+    len++;
+  }
+  return len;
+}
+
+// CopyFrom
+// Make this tree a read-only copy of another, nodes in one arena in the
+// source's layout order. Memory is touched by the calling thread, so
+// running this on a thread bound to a NUMA node places the copy there.
+//
+// @In: source tree to copy; must be empty of concurrent inserts
+// @Out: -
+void TernaryTree::CopyFrom(TernaryTree &source)
+{
+  max_diff_ = source.max_diff_;
+  budget_ = source.budget_;
+  surface_ = source.surface_;
+  root_levels_ = source.root_levels_;
+  compress_ = source.compress_;
+  huge_pages_ = source.huge_pages_;
+  delete deletion_index_;
+  deletion_index_ = NULL;
+  if (source.deletion_index_) {
+    source.deletion_index_->Finalize();
+    deletion_index_ = new DeletionIndex(*source.deletion_index_);
+  }
+  delete bloom_;
+  bloom_ = source.bloom_ ? new BloomFilter(*source.bloom_) : NULL;
+
+  // An arena holding the whole tree is already in layout order
+  std::vector< TNode * > order;
+  if (source.arena_ && source.arena_size_ == source.node_count_) {
+    for (size_t i = 0; i < source.arena_size_; i++)
+      order.push_back(&source.arena_[ i ]);
+  } else {
+    source.GetLayoutOrder(LAYOUT_DFS, kHotLevels, &order);
+  }
+  CopyNodes(order, source);
+}
+
+// GetLayoutOrder
+// List every node in the order Relayout stores them.
+//
+// @In: layout order for the subtrees below the hot levels
+// hot_levels node levels laid out breadth-first
+// @Out: order nodes appended
+void TernaryTree::GetLayoutOrder(
+    LAYOUT layout,
+    int hot_levels,
+    std::vector< TNode * > *order)
+{
+  if (!root_)
+    return;
+
+  // Hot levels, breadth-first; their children start the subtrees
+  std::vector< TNode * > level(1, root_);
+  std::vector< TNode * > next;
+  order->reserve(node_count_);
+  for (int depth = 0; depth < hot_levels && !level.empty(); depth++) {
+    next.clear();
+    for (auto node : level) {
+      order->push_back(node);
+      if (node->GetCenter())
+        next.push_back(node->GetCenter());
+      if (node->GetLeft())
+        next.push_back(node->GetLeft());
+      if (node->GetRight())
+        next.push_back(node->GetRight());
+    }
+    level.swap(next);
+  }
+  for (auto node : level) {
+    if (LAYOUT_VEB == layout)
+      LayoutVeb(node, GetHeight(node), order);
+    else
+      LayoutDfs(node, order);
+  }
+}
+
+// CopyNodes
+// Copy nodes into a new arena and point this tree's root and root tables
+// at the copies. source may be this tree.
+//
+// @In: order nodes of source, in arena order
+// source tree owning the nodes
+// @Out: -
+void TernaryTree::CopyNodes(
+    const std::vector< TNode * > &order,
+    TernaryTree &source)
+{
+  size_t bytes = 0;
+  TNode *arena = AllocArena(order.size(), &bytes);
+  std::unordered_map< TNode *, TNode * > moved(order.size() * 2);
+  moved[ NULL ] = NULL;
+  for (size_t i = 0; i < order.size(); i++) {
+    new (&arena[ i ]) TNode(*order[ i ]);
+    moved[ order[ i ] ] = &arena[ i ];
+  }
+  for (size_t i = 0; i < order.size(); i++) {
+    TNode *node = &arena[ i ];
+    node->parent_ = moved[ node->parent_ ];
+    node->l_ = moved[ node->l_ ];
+    node->c_ = moved[ node->c_ ];
+    node->r_ = moved[ node->r_ ];
+  }
+  root_ = moved[ source.root_ ];
+  for (int i = 0; i < 256; i++) {
+    root_table_[ i ] = moved[ source.root_table_[ i ] ];
+    if (!source.root_table2_[ i ])
+      continue;
+    if (!root_table2_[ i ])
+      root_table2_[ i ] = new TNode *[ 256 ]();
+    for (int j = 0; j < 256; j++)
+      root_table2_[ i ][ j ] = moved[ source.root_table2_[ i ][ j ] ];
+  }
+
+  arena_ = arena;
+  arena_size_ = order.size();
+  arena_bytes_ = bytes;
+  node_count_ = order.size();
+}
+
+// AllocArena
+// Allocate node storage, backed by huge pages when enabled. Explicit huge
+// pages fall back to transparent ones when none are reserved.
+//
+// @In: count number of nodes
+// @Out: arena, uninitialized
+// bytes mapped length to pass to FreeArena, 0 == malloc'd
+TNode *TernaryTree::AllocArena(size_t count, size_t *bytes)
+{
+  const size_t kHugePage = 2 << 20;
+  size_t len = (count * sizeof(TNode) + kHugePage - 1) & ~(kHugePage - 1);
+  void *mem = MAP_FAILED;
+
+  *bytes = 0;
+  if (HUGE_PAGES_EXPLICIT == huge_pages_) {
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (MAP_FAILED == mem)
+      VERBOSE_LOG(LOG_INFO, "No explicit huge pages; using transparent." << std::endl);
+  }
+  if (MAP_FAILED == mem && HUGE_PAGES_NONE != huge_pages_) {
+    // Map an extra huge page and trim to a huge page boundary
+    char *raw = (char *) mmap(NULL, len + kHugePage, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED != (void *) raw) {
+      char *aligned = (char *) (((uintptr_t) raw + kHugePage - 1) & ~(kHugePage - 1));
+      size_t head = aligned - raw;
+      if (head)
+        munmap(raw, head);
+      munmap(aligned + len, kHugePage - head);
+      madvise(aligned, len, MADV_HUGEPAGE);
+      mem = aligned;
+    }
+  }
+  if (MAP_FAILED != mem) {
+    *bytes = len;
+    return (TNode *) mem;
+  }
+
+  TNode *arena = (TNode *) malloc(count * sizeof(TNode));
+  assert(arena);
+  return arena;
+}
+
+// FreeArena
+//
+// @In: arena arena from AllocArena, may be NULL
+// bytes length AllocArena reported
+// @Out: -
+void TernaryTree::FreeArena(TNode *arena, size_t bytes)
+{
+  if (bytes)
+    munmap(arena, bytes);
+  else
+    free(arena);
+}
+
+// LayoutDfs
+// Append a subtree depth-first, each node followed by its center child
+// so a matching key's next comparison is usually on the same line.
+//
+// @In: pNode subtree root
+// @Out: order nodes appended
+void TernaryTree::LayoutDfs(TNode *pNode, std::vector< TNode * > *order)
+{
+  if (!pNode)
+    return;
+  order->push_back(pNode);
+  LayoutDfs(pNode->GetCenter(), order);
+  LayoutDfs(pNode->GetLeft(), order);
+  LayoutDfs(pNode->GetRight(), order);
+}
+
+// LayoutVeb
+// Append the top height levels of a subtree in van Emde Boas order: the
+// upper half of the levels first, then each subtree hanging below it, all
+// laid out the same way. Any root-to-leaf walk then touches about
+// log(height) blocks whatever the cache line size.
+//
+// @In: pNode subtree root
+// height levels to lay out
+// @Out: order nodes appended
+void TernaryTree::LayoutVeb(
+    TNode *pNode,
+    int height,
+    std::vector< TNode * > *order)
+{
+  if (!pNode || height <= 0)
+    return;
+  if (1 == height) {
+    order->push_back(pNode);
+    return;
+  }
+
+  int top = height >> 1;
+  LayoutVeb(pNode, top, order);
+  std::vector< TNode * > bottom;
+  CollectLevel(pNode, top, &bottom);
+  for (auto node : bottom)
+    LayoutVeb(node, height - top, order);
+}
+
+// GetHeight
+// Number of node levels (l/c/r hops) below and including a node.
+//
+// @In: pNode subtree root
+// @Out: height, 0 for NULL
+int TernaryTree::GetHeight(TNode *pNode)
+{
+  if (!pNode)
+    return 0;
+  int c = GetHeight(pNode->GetCenter());
+  int l = GetHeight(pNode->GetLeft());
+  int r = GetHeight(pNode->GetRight());
+  return 1 + std::max(c, std::max(l, r));
+}
+
+// CollectLevel
+// Gather the nodes a given number of hops below a node.
+//
+// @In: pNode subtree root
+// depth hops below pNode
+// @Out: nodes nodes appended, center children first
+void TernaryTree::CollectLevel(
+    TNode *pNode,
+    int depth,
+    std::vector< TNode * > *nodes)
+{
+  if (!pNode)
+    return;
+  if (!depth) {
+    nodes->push_back(pNode);
+    return;
+  }
+  CollectLevel(pNode->GetCenter(), depth - 1, nodes);
+  CollectLevel(pNode->GetLeft(), depth - 1, nodes);
+  CollectLevel(pNode->GetRight(), depth - 1, nodes);
+}
 
 // CalcLevenshtein
 //
-// This is an optimized Levenshtein string distance calculation.
+// Plain Levenshtein string distance.
 // It returns how "different" two strings are, effectively performing
 // a commutative subtraction operation.
 //
@@ -355,29 +1427,23 @@ TNode *TernaryTree::AllocNode(char key)
 // @Out: Levenshtein difference
 int TernaryTree::CalcLevenshtein(const char *s1, const char *s2)
 {
-  int score = -1;
-  if (s1 && s2) {
-    unsigned int len1, len2, x, y, lastdiag, olddiag;
-    len1 = strlen(s1);
-    len2 = strlen(s2);
-    unsigned int column[ len1 + 1 ];
-    for (y = 1; y <= len1; y++)
-      column[ y ] = y;
-    for (x = 1; x <= len2; x++) {
-      column[ 0 ] = x;
-      for (y = 1, lastdiag = x - 1; y <= len1; y++) {
-        olddiag = column[ y ];
-        column[y] = MIN3(column[ y ] + 1,
-          column[ y - 1 ] + 1,
-          lastdiag +
-          (
-           s1[ y - 1 ] == s2[ x - 1 ] ? 0 : 1
-          )
-        );
-        lastdiag = olddiag;
-      }
-    }
-    score = column[ len1 ];
-  }
-  return score;
+  return CalcDistance<UnitCost>(s1, s2);
 }
+
+// Instantiate the fuzzy lookups for each stock cost model
+#define INSTANTIATE_COST_MODEL(Model) \
+  template void TernaryTree::FuzzyFind<Model>( \
+    const char *, TNode *, std::map< int, std::string > *, \
+    QueryStatus *, const QueryBudget *, size_t); \
+  template bool TernaryTree::ExtrapolateAll<Model>( \
+    TNode *, std::map< int, std::string > *, std::deque< UCHAR > *, \
+    const char *, const char *, bool, QueryStatus *, const QueryBudget *); \
+  template void TernaryTree::ExtrapolateStem<Model>( \
+    TNode *, std::deque< UCHAR > *, bool, ExtrapolateContext *); \
+  template bool TernaryTree::Extrapolate<Model>( \
+    TNode *, TNode *, std::deque< UCHAR > *, ExtrapolateContext *, int);
+
+INSTANTIATE_COST_MODEL(UnitCost)
+INSTANTIATE_COST_MODEL(DamerauCost)
+INSTANTIATE_COST_MODEL(CaseFoldCost)
+INSTANTIATE_COST_MODEL(KeyboardCost)
@@ -0,0 +1,165 @@
+/* Dicto
+ * batch_scorer_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include "batch_scorer.h"
+#include "edit_cost.h"
+#include "test.h"
+
+static uint32_t _seed = 12345;
+
+// Random
+// Deterministic LCG, so failures reproduce.
+static uint32_t Random(uint32_t range)
+{
+  _seed = _seed * 1103515245 + 12345;
+  return (_seed >> 8) % range;
+}
+
+// RandomWord
+// A word over a small alphabet, so candidates share characters with the
+// query; bytes above 0x7f check the unsigned compares.
+//
+// @In:     len length
+// @Out:    word
+static std::string RandomWord(int len)
+{
+  static const char alphabet[] = "abcde\xc3\xa9\xff";
+  std::string word;
+  for (int i = 0; i < len; i++)
+    word.push_back(alphabet[ Random(sizeof(alphabet) - 1) ]);
+  return word;
+}
+
+// CheckBatch
+// Score a batch with the current kernel and compare every lane with the
+// reference distance.
+//
+// @In:     query query
+//          candidates up to kLanes candidates, none longer than kMaxWordLen
+// @Out:    number of lanes that differed
+static int CheckBatch(
+    const std::string &query,
+    const std::vector< std::string > &candidates)
+{
+  BatchScorer batch(query.c_str());
+  for (auto &c : candidates)
+    CHECK(batch.Add(c));
+  int scores[ BatchScorer::kLanes ];
+  batch.Score(scores);
+
+  int mismatches = 0;
+  for (size_t k = 0; k < candidates.size(); k++) {
+    int expected = CalcDistance<UnitCost>(query.c_str(), candidates[ k ].c_str());
+    if (scores[ k ] != expected) {
+      if (!mismatches)
+        std::cerr << BatchScorer::GetImplementation() << ": lane " << k
+          << " of " << candidates.size() << ", query length " << query.length()
+          << ", candidate length " << candidates[ k ].length() << ": "
+          << scores[ k ] << " != " << expected << std::endl;
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+// CheckKernel
+// Compare the current kernel with CalcDistance on random batches, batches
+// filled to each side of the SIMD lane boundaries, and the longest
+// queries and candidates that are batched.
+//
+// @In:     -
+// @Out:    -
+static void CheckKernel()
+{
+  // Random batches of every size
+  for (int n = 0; n < 2000; n++) {
+    std::string query = RandomWord(Random(24));
+    std::vector< std::string > candidates;
+    int count = 1 + Random(BatchScorer::kLanes);
+    for (int k = 0; k < count; k++)
+      candidates.push_back(RandomWord(Random(BatchScorer::kMaxWordLen + 1)));
+    CHECK_EQ(CheckBatch(query, candidates), 0);
+  }
+
+  // Counts either side of the 16 lane SSE2 pass
+  for (int count : { 1, 15, 16, 17, 31, 32 }) {
+    std::string query = RandomWord(10);
+    std::vector< std::string > candidates;
+    for (int k = 0; k < count; k++)
+      candidates.push_back(RandomWord(k % (BatchScorer::kMaxWordLen + 1)));
+    CHECK_EQ(CheckBatch(query, candidates), 0);
+  }
+
+  // The largest distances 8-bit lanes hold: the longest query against
+  // the longest candidate with nothing in common, and against ""
+  for (int query_len : { BatchScorer::kMaxQueryLen - 1, BatchScorer::kMaxQueryLen }) {
+    std::string query(query_len, 'a');
+    std::vector< std::string > candidates = {
+      std::string(BatchScorer::kMaxWordLen, 'b'),
+      std::string(BatchScorer::kMaxWordLen, 'a'),
+      "",
+      RandomWord(BatchScorer::kMaxWordLen),
+    };
+    CHECK_EQ(CheckBatch(query, candidates), 0);
+    candidates.clear();
+    for (int k = 0; k < BatchScorer::kLanes; k++)
+      candidates.push_back(RandomWord(BatchScorer::kMaxWordLen - k % 3));
+    CHECK_EQ(CheckBatch(RandomWord(query_len), candidates), 0);
+  }
+
+  // Anything longer would overflow a lane and is refused, to be scored
+  // directly
+  std::string longest(BatchScorer::kMaxQueryLen + 1, 'a');
+  std::string past_byte(300, 'a');
+  CHECK(!BatchScorer(longest.c_str()).Add("a"));
+  CHECK(!BatchScorer(past_byte.c_str()).Add("a"));
+  CHECK(!BatchScorer("a").Add(std::string(BatchScorer::kMaxWordLen + 1, 'a')));
+  BatchScorer full("a");
+  for (int k = 0; k < BatchScorer::kLanes; k++)
+    CHECK(full.Add("b"));
+  CHECK(!full.Add("b"));
+}
+
+int main()
+{
+  int tested = 0;
+  for (const char *name : { "avx2", "sse2", "scalar" }) {
+    if (!BatchScorer::SetImplementation(name)) {
+      std::cerr << name << ": not supported, skipped" << std::endl;
+      continue;
+    }
+    CheckKernel();
+    tested++;
+  }
+  CHECK(tested > 0);
+
+  CHECK(BatchScorer::SetImplementation("none"));
+  CHECK(!BatchScorer("a").Add("b"));
+  CHECK(!BatchScorer::SetImplementation("mmx"));
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,160 @@
+/* Dicto
+ * bloom_filter_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "dict_loader.h"
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// BloomTree
+// Opens up the prefix bound the stem search uses.
+class BloomTree : public TernaryTree {
+ public:
+  using TernaryTree::GetBloomPrefix;
+};
+
+// CheckNoFalseNegatives
+// Every prefix and every word in the tree must be reported present, and
+// the prefix bound must cover each whole word.
+//
+// @In:     tree tree with a filter
+//          words words under its root
+// @Out:    -
+static void CheckNoFalseNegatives(BloomTree *tree, const std::vector< std::string > &words)
+{
+  BloomFilter *bloom = tree->GetBloomFilter();
+  int misses = 0;
+  for (auto &w : words) {
+    std::string buffer;
+    const char *key = CaseFolder::Fold(w.c_str(), &buffer);
+    uint64_t state = BloomFilter::Start();
+    for (const char *p = key; *p; p++) {
+      state = BloomFilter::Step(state, (UCHAR) *p);
+      misses += !bloom->MayContain(state);
+    }
+    misses += !bloom->MayContain(BloomFilter::WordKey(state));
+    misses += tree->GetBloomPrefix(key) != strlen(key);
+    misses += !tree->Find(w.c_str(), tree->GetRoot());
+  }
+  CHECK_EQ(misses, 0);
+}
+
+// CheckFuzzyUnchanged
+// FuzzyFind must return the same results with and without the filter.
+//
+// @In:     tree tree with a filter
+//          plain same words, no filter
+//          queries lookups to compare
+// @Out:    -
+static void CheckFuzzyUnchanged(
+    TernaryTree *tree,
+    TernaryTree *plain,
+    const std::vector< std::string > &queries)
+{
+  int differ = 0;
+  for (auto &q : queries) {
+    std::map< int, std::string > filtered, unfiltered;
+    tree->FuzzyFind(q.c_str(), tree->GetRoot(), &filtered);
+    plain->FuzzyFind(q.c_str(), plain->GetRoot(), &unfiltered);
+    if (filtered != unfiltered && !differ++)
+      std::cerr << "FuzzyFind \"" << q << "\" differs" << std::endl;
+  }
+  CHECK_EQ(differ, 0);
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+
+  DictionaryLoader loader;
+  CHECK(loader.Load("res/dict.txt"));
+  std::vector< std::string > words, late;
+  for (size_t i = 0; i < loader.GetWordCount(); i++)
+    (i % 10 ? words : late).push_back(loader.GetWord(i));
+  words.push_back("Paris");
+  words.push_back("\xc3\x89t\xc3\xa9");
+
+  std::vector< std::string > queries = { "PARIS", "\xc3\xa9t\xc3\xa9" };
+  uint32_t seed = 2718;
+  for (size_t i = 0; i < words.size(); i += 97) {
+    std::string q = words[ i ];
+    seed = seed * 1103515245 + 12345;
+    queries.push_back(q);
+    queries.push_back(q + "s");
+    queries.push_back(q.substr(0, 1 + (seed >> 16) % q.length()));
+    q[ (seed >> 8) % q.length() ] = (char) ('a' + (seed >> 4) % 26);
+    queries.push_back(q);
+  }
+
+  // Filters at a usual rate and a coarse one; built from a tree with
+  // runs and root table nodes, then grown past their sizing by inserts
+  for (double fp_rate : { 0.01, 0.3 }) {
+    for (int levels : { 0, 2 }) {
+      BloomTree tree;
+      TernaryTree plain;
+      tree.SetMaxDifference(2);
+      plain.SetMaxDifference(2);
+      tree.EnableRootTable(levels);
+      plain.EnableRootTable(levels);
+      for (auto &w : words) {
+        tree.Insert(w.c_str());
+        plain.Insert(w.c_str());
+      }
+      tree.EnableBloomFilter(fp_rate);
+      CheckNoFalseNegatives(&tree, words);
+      CheckFuzzyUnchanged(&tree, &plain, queries);
+
+      for (auto &w : late) {
+        tree.Insert(w.c_str());
+        plain.Insert(w.c_str());
+      }
+      CheckNoFalseNegatives(&tree, late);
+      CheckNoFalseNegatives(&tree, words);
+      CheckFuzzyUnchanged(&tree, &plain, queries);
+      tree.Relayout();
+      plain.Relayout();
+      CheckFuzzyUnchanged(&tree, &plain, queries);
+    }
+  }
+
+  // The filter does turn absent words away, near the rate asked for
+  BloomTree tree;
+  for (auto &w : words)
+    tree.Insert(w.c_str());
+  tree.EnableBloomFilter(0.01);
+  size_t passed = 0;
+  const size_t absent = 20000;
+  for (size_t i = 0; i < absent; i++) {
+    std::string word = "qzx" + std::to_string(i);
+    passed += tree.GetBloomFilter()->MayContain(BloomFilter::WordKey(word.c_str()));
+  }
+  CHECK(passed < absent * 3 / 100);
+
+  return TEST_RESULT();
+}
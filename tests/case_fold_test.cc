@@ -0,0 +1,75 @@
+/* Dicto
+ * case_fold_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <string>
+#include "case_fold.h"
+#include "test.h"
+
+// CheckFold
+// Fold a UTF-8 word and compare it with the expected result.
+//
+// @In:     word word to fold
+//          expected simple case folding of word
+// @Out:    -
+static void CheckFold(const char *word, const char *expected)
+{
+  std::string buffer;
+  CHECK_EQ(std::string(CaseFolder::Fold(word, &buffer)), std::string(expected));
+}
+
+int main(int argc, char **argv)
+{
+  // Regular pairs
+  CHECK_EQ(CaseFolder::FoldCodepoint('Q'), (uint32_t) 'q');
+  CHECK_EQ(CaseFolder::FoldCodepoint(0xC9), 0xE9u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x100), 0x101u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1CD), 0x1CEu);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x391), 0x3B1u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x410), 0x430u);
+
+  // Irregular Latin Extended-B capitals
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x18F), 0x259u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x186), 0x254u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1F6), 0x195u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1F7), 0x1BFu);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x220), 0x19Eu);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1C5), 0x1C6u);
+
+  // Simple foldings outside the regular pairs
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1E9B), 0x1E61u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1E9E), 0xDFu);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x3C2), 0x3C3u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x212A), (uint32_t) 'k');
+
+  // Lowercase and uncovered code points pass through
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x259), 0x259u);
+  CHECK_EQ(CaseFolder::FoldCodepoint(0x1F08), 0x1F08u);
+
+  CheckFold("\xC6\x8F" "Q", "\xC9\x99" "q");
+  CheckFold("\xC8\xA0" "ar", "\xC6\x9E" "ar");
+  CheckFold("caf\xC3\x89", "caf\xC3\xA9");
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,192 @@
+/* Dicto
+ * deletion_index_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "dict_loader.h"
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// Levenshtein
+// Reference distance over bytes, the same units UnitCost scores in.
+static int Levenshtein(const std::string &a, const std::string &b)
+{
+  std::vector< int > row(b.length() + 1);
+  for (size_t j = 0; j <= b.length(); j++)
+    row[ j ] = (int) j;
+  for (size_t i = 1; i <= a.length(); i++) {
+    int diag = row[ 0 ];
+    row[ 0 ] = (int) i;
+    for (size_t j = 1; j <= b.length(); j++) {
+      int up = row[ j ];
+      int sub = diag + (a[ i - 1 ] != b[ j - 1 ]);
+      row[ j ] = std::min(std::min(row[ j - 1 ], up) + 1, sub);
+      diag = up;
+    }
+  }
+  return row[ b.length() ];
+}
+
+// CheckAgainstScan
+// Index-backed FuzzyFind must return exactly the words a full scan finds
+// within max_diff.
+//
+// @In:     words dictionary
+//          queries lookups to compare
+//          max_diff distance to search
+// @Out:    number of queries that differed
+static int CheckAgainstScan(
+    const std::vector< std::string > &words,
+    const std::vector< std::string > &queries,
+    int max_diff)
+{
+  TernaryTree tree;
+  tree.EnableDeletionIndex(2, 7);
+  tree.SetMaxDifference(max_diff);
+  for (auto &w : words)
+    tree.Insert(w.c_str());
+
+  int mismatches = 0;
+  for (auto &q : queries) {
+    std::string buffer;
+    std::string key = CaseFolder::Fold(q.c_str(), &buffer);
+    std::set< std::string > expected;
+    for (auto &w : words) {
+      std::string folded;
+      if (Levenshtein(key, CaseFolder::Fold(w.c_str(), &folded)) <= max_diff)
+        expected.insert(w);
+    }
+
+    std::map< int, std::string > results;
+    tree.FuzzyFind(q.c_str(), tree.GetRoot(), &results);
+    std::set< std::string > found;
+    for (auto &it : results)
+      found.insert(it.second);
+    if (found != expected) {
+      if (!mismatches)
+        std::cerr << "d" << max_diff << " \"" << q << "\": " << found.size()
+          << " found, " << expected.size() << " expected" << std::endl;
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+// FreeNodes
+// Delete a subtree grown under a caller-held root; the tree only frees
+// its own.
+static void FreeNodes(TNode *node)
+{
+  if (!node)
+    return;
+  FreeNodes(node->GetLeft());
+  FreeNodes(node->GetCenter());
+  FreeNodes(node->GetRight());
+  delete node;
+}
+
+// CheckTwoRoots
+// Words inserted under caller-held roots stay out of the index; a lookup
+// from one of those roots sees only its own words.
+//
+// @In:     index enable the deletion index
+// @Out:    -
+static void CheckTwoRoots(bool index)
+{
+  TernaryTree tree;
+  if (index)
+    tree.EnableDeletionIndex(2, 7);
+  tree.SetMaxDifference(1);
+  TNode *a = NULL;
+  TNode *b = NULL;
+  tree.Insert("cat", &a);
+  tree.Insert("car", &a);
+  tree.Insert("cap", &b);
+  tree.Insert("dog", &b);
+  tree.Insert("cab");
+
+  std::map< int, std::string > results;
+  tree.FuzzyFind("cat", b, &results);
+  CHECK_EQ(results.size(), 1u);
+  CHECK(results.size() && results.begin()->second == "cap");
+
+  results.clear();
+  tree.FuzzyFind("cat", a, &results);
+  std::set< std::string > found;
+  for (auto &it : results)
+    found.insert(it.second);
+  CHECK(found.count("cat"));
+  CHECK(!found.count("cap") && !found.count("cab") && !found.count("dog"));
+
+  results.clear();
+  tree.FuzzyFind("cat", tree.GetRoot(), &results);
+  CHECK_EQ(results.size(), 1u);
+  CHECK(results.size() && results.begin()->second == "cab");
+  FreeNodes(a);
+  FreeNodes(b);
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+
+  // Short words and queries need deletions all the way down to ""
+  std::vector< std::string > words = {
+    "a", "b", "I", "c", "ab", "ba", "abc", "Sq", "q", "qi", "ox", "to", "at"
+  };
+  std::vector< std::string > queries;
+  const char alphabet[] = "abciqx";
+  for (const char *p = alphabet; *p; p++) {
+    queries.push_back(std::string(1, *p));
+    for (const char *r = alphabet; *r; r++)
+      queries.push_back(std::string(1, *p) + *r);
+  }
+  CHECK_EQ(CheckAgainstScan(words, queries, 1), 0);
+  CHECK_EQ(CheckAgainstScan(words, queries, 2), 0);
+
+  CheckTwoRoots(false);
+  CheckTwoRoots(true);
+
+  // A slice of the real dictionary, with typos of its own words
+  DictionaryLoader loader;
+  CHECK(loader.Load("res/dict.txt"));
+  for (size_t i = 0; i < loader.GetWordCount(); i += 25)
+    words.push_back(loader.GetWord(i));
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < words.size(); i += 7) {
+    std::string q = words[ i ];
+    seed = seed * 1103515245 + 12345;
+    q[ (seed >> 16) % q.length() ] = (char) ('a' + (seed >> 8) % 26);
+    queries.push_back(q);
+    queries.push_back(words[ i ]);
+  }
+  CHECK_EQ(CheckAgainstScan(words, queries, 1), 0);
+  CHECK_EQ(CheckAgainstScan(words, queries, 2), 0);
+
+  return TEST_RESULT();
+}
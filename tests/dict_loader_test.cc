@@ -0,0 +1,163 @@
+/* Dicto
+ * dict_loader_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "dict_loader.h"
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// WriteFile
+// Write text to a new temporary file.
+//
+// @In:     text contents
+// @Out:    path of the file; the caller unlinks it
+static std::string WriteFile(const std::string &text)
+{
+  char path[] = "/tmp/dict_loader_testXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  CHECK_EQ(write(fd, text.data(), text.length()), (ssize_t) text.length());
+  close(fd);
+  return path;
+}
+
+// Words
+// Every word a loader holds, in order.
+static std::vector< std::string > Words(DictionaryLoader &loader)
+{
+  std::vector< std::string > words;
+  for (size_t i = 0; i < loader.GetWordCount(); i++)
+    words.push_back(loader.GetWord(i));
+  return words;
+}
+
+// CheckExternalLikeMemory
+// Loading through temporary files, at several run sizes, must give the
+// in-memory load's words and counts, and build the same tree.
+//
+// @In:     path dictionary file
+//          budgets memory budgets to load with
+// @Out:    -
+static void CheckExternalLikeMemory(
+    const char *path,
+    const std::vector< size_t > &budgets = { 1, 20, 64, 4096 })
+{
+  DictionaryLoader memory;
+  CHECK(memory.Load(path));
+  CHECK(!memory.WasExternal());
+  std::vector< std::string > expected = Words(memory);
+  TernaryTree tree;
+  memory.Build(&tree);
+  std::vector< std::string > listed;
+  tree.Complete("", tree.GetRoot(), &listed, SIZE_MAX);
+
+  for (size_t budget : budgets) {
+    DictionaryLoader external;
+    external.SetMemoryBudget(budget);
+    CHECK(external.Load(path));
+    if (!external.WasExternal())
+      continue;                   // file smaller than this budget
+    CHECK(Words(external) == expected);
+    CHECK_EQ(external.GetLineCount(), memory.GetLineCount());
+    CHECK_EQ(external.GetBlankCount(), memory.GetBlankCount());
+    CHECK_EQ(external.GetDuplicateCount(), memory.GetDuplicateCount());
+    CHECK_EQ(external.GetSkippedCount(), memory.GetSkippedCount());
+    CHECK_EQ(external.WasSorted(), memory.WasSorted());
+
+    TernaryTree external_tree;
+    external.Build(&external_tree);
+    std::vector< std::string > external_listed;
+    external_tree.Complete("", external_tree.GetRoot(), &external_listed, SIZE_MAX);
+    CHECK(external_listed == listed);
+    CHECK_EQ(external_tree.GetNodeCount(), tree.GetNodeCount());
+  }
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+
+  // CRLF and LF endings, blank and whitespace-only lines, duplicates in
+  // one run and across runs, words differing only in case, unsorted
+  // input and no newline at the end
+  std::string path = WriteFile(
+    "pear\r\n"
+    "apple\r\n"
+    "\r\n"
+    "  banana \t\r\n"
+    "apple\n"
+    "\n"
+    "Apple\n"
+    "cherry\r\n"
+    "   \n"
+    "pear\n"
+    "zucchini\r\n"
+    "banana\n"
+    "\xc3\xa9t\xc3\xa9\r\n"
+    "apple\r\n"
+    "fig");
+  DictionaryLoader loader;
+  CHECK(loader.Load(path.c_str()));
+  CHECK(Words(loader) == std::vector< std::string >({
+    "Apple", "apple", "banana", "cherry", "fig", "pear", "zucchini",
+    "\xc3\xa9t\xc3\xa9" }));
+  CHECK_EQ(loader.GetLineCount(), 15u);
+  CHECK_EQ(loader.GetBlankCount(), 3u);
+  CHECK_EQ(loader.GetDuplicateCount(), 4u);
+  CHECK(!loader.WasSorted());
+  CheckExternalLikeMemory(path.c_str());
+  unlink(path.c_str());
+
+  // More one-word runs than are kept open at once
+  std::string many;
+  for (int i = 0; i < 3 * (int) DictionaryLoader::kMaxRuns; i++)
+    many += std::to_string(i * 7919 % 1000) + (i & 1 ? "\r\n" : "\n");
+  path = WriteFile(many);
+  CheckExternalLikeMemory(path.c_str());
+  unlink(path.c_str());
+
+  // Sorted input, and a file of nothing but blank lines
+  path = WriteFile("a\nb\r\nb\nc\n");
+  CheckExternalLikeMemory(path.c_str());
+  unlink(path.c_str());
+  path = WriteFile("\r\n\n \n\t\r\n");
+  CheckExternalLikeMemory(path.c_str());
+  DictionaryLoader blank;
+  blank.SetMemoryBudget(1);
+  CHECK(blank.Load(path.c_str()));
+  CHECK(blank.WasExternal());
+  CHECK_EQ(blank.GetWordCount(), 0u);
+  unlink(path.c_str());
+
+  // The real dictionary, in more runs than are kept open at once
+  CheckExternalLikeMemory("res/dict.txt", { 4 << 10, 64 << 10 });
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,178 @@
+/* Dicto
+ * layered_dictionary_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "layered_dictionary.h"
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// Words
+// The words of a fuzzy result, without scores.
+static std::set< std::string > Words(const std::map< int, std::string > &results)
+{
+  std::set< std::string > words;
+  for (auto &it : results)
+    words.insert(it.second);
+  return words;
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+  const char *base_words[] = { "car", "cart", "carton", "cat", "dog" };
+
+  // Tenants come and go over one base; each frees its own nodes
+  TernaryTree base;
+  for (auto w : base_words)
+    base.Insert(w);
+  base.Relayout();
+  base.Insert("cab");             // heap node next to the arena
+  for (int i = 0; i < 100; i++) {
+    LayeredDictionary tenant(&base);
+    tenant.Add("cars");
+    tenant.Add("zebra");
+    tenant.Suppress("dog");
+    tenant.Suppress("zebra");
+    CHECK(tenant.Find("cars"));
+    CHECK(!tenant.Find("zebra"));
+    CHECK(!tenant.Find("dog"));
+    CHECK(tenant.Find("cat"));
+  }
+
+  // Completions merge in order, less the suppressed
+  LayeredDictionary tenant(&base);
+  tenant.Add("cars");
+  tenant.Suppress("cat");
+  std::vector< std::string > completions;
+  tenant.Complete("ca", &completions, 10);
+  std::vector< std::string > expected = { "cab", "car", "cars", "cart", "carton" };
+  CHECK(completions == expected);
+
+  // SIZE_MAX lists everything, and suppressed words with several
+  // spellings still leave the limit's worth of survivors
+  TernaryTree cased;
+  for (auto w : { "aa", "ab", "Ab", "AB", "ac", "ad", "ae" })
+    cased.Insert(w);
+  LayeredDictionary hiding(&cased);
+  hiding.Suppress("aa");
+  hiding.Suppress("ab");
+  completions.clear();
+  hiding.Complete("a", &completions, SIZE_MAX);
+  CHECK(completions == std::vector< std::string >({ "ac", "ad", "ae" }));
+  completions.clear();
+  hiding.Complete("a", &completions, 3);
+  CHECK(completions == std::vector< std::string >({ "ac", "ad", "ae" }));
+  completions.clear();
+  hiding.Complete("a", &completions, 2);
+  CHECK(completions == std::vector< std::string >({ "ac", "ad" }));
+
+  // Without a deletion index every layer walks from the stem one tree
+  // holding the tenant's words would pick, even where a layer alone holds
+  // a longer prefix (suppressed "carton") or a shorter one
+  tenant.Add("cartel");
+  tenant.Suppress("carton");
+  TernaryTree single;
+  for (auto w : { "cab", "car", "cars", "cart", "cartel", "dog" })
+    single.Insert(w);
+  const char *queries[] = {
+    "cart", "car", "cars", "carts", "carto", "cartoon", "carte", "cas",
+    "cat", "ca", "c", "dgo", "do", "x", "Cart"
+  };
+  for (const char *q : queries) {
+    std::map< int, std::string > merged;
+    std::map< int, std::string > one_tree;
+    tenant.FuzzyFindWithModel('u', q, &merged);
+    single.FuzzyFind(q, single.GetRoot(), &one_tree);
+    if (Words(merged) != Words(one_tree))
+      std::cerr << "walk \"" << q << "\"" << std::endl;
+    CHECK(Words(merged) == Words(one_tree));
+  }
+
+  // The layers share one budget: what a query needs in total is enough,
+  // and one less is partial without going over
+  for (const char *q : queries) {
+    std::map< int, std::string > full;
+    QueryStatus need;
+    tenant.FuzzyFindWithModel('u', q, &full, &need);
+    CHECK(!need.partial);
+
+    QueryBudget budget;
+    budget.max_visits = need.visits;
+    budget.max_candidates = need.candidates;
+    std::map< int, std::string > exact;
+    QueryStatus status;
+    tenant.FuzzyFindWithModel('u', q, &exact, &status, &budget);
+    CHECK(!status.partial);
+    CHECK(Words(exact) == Words(full));
+
+    if (need.candidates > 1) {      // 0 would mean unlimited
+      QueryBudget fewer;
+      fewer.max_candidates = need.candidates - 1;
+      std::map< int, std::string > cut;
+      tenant.FuzzyFindWithModel('u', q, &cut, &status, &fewer);
+      CHECK(status.partial);
+      CHECK(status.candidates <= fewer.max_candidates);
+    }
+    if (need.visits > 1) {
+      QueryBudget fewer;
+      fewer.max_visits = need.visits - 1;
+      std::map< int, std::string > cut;
+      tenant.FuzzyFindWithModel('u', q, &cut, &status, &fewer);
+      CHECK(status.partial);
+      CHECK(status.visits <= need.visits);
+    }
+  }
+
+  // With a deletion index every layer is exhaustive and the merge matches
+  TernaryTree indexed;
+  indexed.EnableDeletionIndex(2, 7);
+  indexed.SetMaxDifference(2);
+  for (auto w : base_words)
+    indexed.Insert(w);
+  TernaryTree indexed_single;
+  indexed_single.EnableDeletionIndex(2, 7);
+  indexed_single.SetMaxDifference(2);
+  for (auto w : base_words)
+    if (strcmp(w, "cat"))
+      indexed_single.Insert(w);
+  indexed_single.Insert("cars");
+  LayeredDictionary indexed_tenant(&indexed);
+  indexed_tenant.Add("cars");
+  indexed_tenant.Suppress("cat");
+  indexed_tenant.Finalize();
+  for (const char *q : { "cart", "car", "cas", "dgo", "carts" }) {
+    std::map< int, std::string > layered_results;
+    std::map< int, std::string > single_results;
+    indexed_tenant.FuzzyFindWithModel('u', q, &layered_results);
+    indexed_single.FuzzyFind(q, indexed_single.GetRoot(), &single_results);
+    CHECK(Words(layered_results) == Words(single_results));
+  }
+
+  return TEST_RESULT();
+}
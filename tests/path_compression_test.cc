@@ -0,0 +1,134 @@
+/* Dicto
+ * path_compression_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// Words
+// The words of a fuzzy result, without scores.
+static std::set< std::string > Words(const std::map< int, std::string > &results)
+{
+  std::set< std::string > words;
+  for (auto &it : results)
+    words.insert(it.second);
+  return words;
+}
+
+// CheckLikeUncompressed
+// A tree with path compression must answer Find, Complete and FuzzyFind
+// exactly as one without it. Words are inserted in the given order, so a
+// later word can split a run an earlier one left.
+//
+// @In:     words words to insert, in order
+//          queries lookups to compare; every prefix of every word is
+//          tried as well
+// @Out:    -
+static void CheckLikeUncompressed(
+    const std::vector< std::string > &words,
+    const std::vector< std::string > &queries)
+{
+  TernaryTree compressed;
+  TernaryTree plain;
+  plain.SetPathCompression(false);
+  compressed.SetMaxDifference(2);
+  plain.SetMaxDifference(2);
+  std::set< std::string > present;
+  for (auto &w : words) {
+    compressed.Insert(w.c_str());
+    plain.Insert(w.c_str());
+    present.insert(w);
+  }
+  CHECK(compressed.GetNodeCount() <= plain.GetNodeCount());
+
+  std::set< std::string > all(queries.begin(), queries.end());
+  for (auto &w : words)
+    for (size_t i = 0; i <= w.length() + 1; i++)
+      all.insert(w.substr(0, i) + (i > w.length() ? "z" : ""));
+
+  for (auto &q : all) {
+    CHECK_EQ(compressed.Find(q.c_str(), compressed.GetRoot()), present.count(q) > 0);
+    CHECK_EQ(plain.Find(q.c_str(), plain.GetRoot()), present.count(q) > 0);
+
+    std::vector< std::string > got, expected;
+    compressed.Complete(q.c_str(), compressed.GetRoot(), &got, SIZE_MAX);
+    plain.Complete(q.c_str(), plain.GetRoot(), &expected, SIZE_MAX);
+    CHECK(got == expected);
+
+    std::map< int, std::string > fuzzy, fuzzy_plain;
+    compressed.FuzzyFind(q.c_str(), compressed.GetRoot(), &fuzzy);
+    plain.FuzzyFind(q.c_str(), plain.GetRoot(), &fuzzy_plain);
+    if (fuzzy != fuzzy_plain)
+      std::cerr << "FuzzyFind \"" << q << "\" differs" << std::endl;
+    CHECK(fuzzy == fuzzy_plain);
+  }
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+
+  // A query ending inside a run finds nothing exactly, completes to the
+  // run's word and extrapolates from it
+  TernaryTree tree;
+  tree.Insert("carton");
+  CHECK(!tree.Find("cart", tree.GetRoot()));
+  CHECK(!tree.Find("cartx", tree.GetRoot()));
+  CHECK(tree.Find("carton", tree.GetRoot()));
+  std::vector< std::string > completions;
+  tree.Complete("cart", tree.GetRoot(), &completions, 10);
+  CHECK(completions == std::vector< std::string >({ "carton" }));
+  std::map< int, std::string > fuzzy;
+  tree.FuzzyFind("carto", tree.GetRoot(), &fuzzy);
+  CHECK(Words(fuzzy) == std::set< std::string >({ "carton" }));
+  CheckLikeUncompressed({ "carton" }, { "cart", "carto", "cartons", "cartox" });
+
+  // Runs longer than one node holds, split at every offset: by a prefix
+  // (a terminator inside the run), by a diverging word, and by both
+  // orders of insert
+  const std::string long_word = "abcdefghijklmnopqrst";
+  CHECK(long_word.length() > 2 * TNode::kMaxTail);
+  for (size_t i = 1; i < long_word.length(); i++) {
+    std::string prefix = long_word.substr(0, i);
+    std::string fork = prefix + "Z";
+    std::string branch = prefix + (char) (long_word[ i ] + 1) + "xyz";
+    CheckLikeUncompressed({ long_word, prefix }, { });
+    CheckLikeUncompressed({ prefix, long_word }, { });
+    CheckLikeUncompressed({ long_word, branch, fork }, { });
+    CheckLikeUncompressed({ branch, long_word, prefix }, { });
+  }
+
+  // A small real-world mix: shared stems, words inside other words' runs
+  CheckLikeUncompressed(
+    { "piano", "pianist", "pianos", "pi", "pianoforte", "pianola", "pie",
+      "pianistic", "a", "an", "ant", "antidisestablishment", "antic" },
+    { "pianx", "pianofort", "antidis", "anti", "pia", "p", "" });
+
+  return TEST_RESULT();
+}
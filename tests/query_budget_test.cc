@@ -0,0 +1,136 @@
+/* Dicto
+ * query_budget_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <string>
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// CheckCandidateLimit
+// A budget of exactly the candidates a query needs must give the full,
+// non-partial answer; one fewer must be partial.
+//
+// @In:     tree tree to query
+//          word query
+// @Out:    -
+static void CheckCandidateLimit(TernaryTree *tree, const char *word)
+{
+  std::map< int, std::string > full;
+  QueryStatus status;
+  tree->FuzzyFind(word, tree->GetRoot(), &full, &status);
+  CHECK(!status.partial);
+  CHECK(status.candidates > 1);
+
+  QueryBudget budget;
+  budget.max_candidates = status.candidates;
+  std::map< int, std::string > exact;
+  QueryStatus exact_status;
+  tree->FuzzyFind(word, tree->GetRoot(), &exact, &exact_status, &budget);
+  CHECK(!exact_status.partial);
+  CHECK_EQ(exact_status.candidates, status.candidates);
+  CHECK(exact == full);
+
+  budget.max_candidates = status.candidates - 1;
+  std::map< int, std::string > cut;
+  QueryStatus cut_status;
+  tree->FuzzyFind(word, tree->GetRoot(), &cut, &cut_status, &budget);
+  CHECK(cut_status.partial);
+  CHECK_EQ(cut_status.candidates, budget.max_candidates);
+}
+
+// CheckStemSearchCharged
+// A long query that doesn't match walks the tree once per stem length
+// tried; that walk is charged to the budget like the extrapolation.
+//
+// @In:     tree tree to query
+//          word long query whose stem search enters many nodes
+// @Out:    -
+static void CheckStemSearchCharged(TernaryTree *tree, const char *word)
+{
+  std::map< int, std::string > full;
+  QueryStatus status;
+  tree->FuzzyFind(word, tree->GetRoot(), &full, &status);
+  CHECK(!status.partial);
+  CHECK(status.visits > 1000);
+
+  QueryBudget budget;
+  budget.max_visits = 50;
+  std::map< int, std::string > cut;
+  QueryStatus cut_status;
+  tree->FuzzyFind(word, tree->GetRoot(), &cut, &cut_status, &budget);
+  CHECK(cut_status.partial);
+  CHECK(cut_status.visits <= budget.max_visits + 1);
+
+  // The clock is read every 64 visits, so a 1 usec deadline stops the
+  // search long before its end
+  QueryBudget deadline;
+  deadline.deadline_us = 1;
+  QueryStatus late_status;
+  cut.clear();
+  tree->FuzzyFind(word, tree->GetRoot(), &cut, &late_status, &deadline);
+  CHECK(late_status.partial);
+  CHECK(late_status.visits < status.visits);
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+  const char *words[] = { "car", "card", "care", "cared", "cars", "cart", "cat" };
+
+  // Tree walk
+  TernaryTree walk;
+  for (auto w : words)
+    walk.Insert(w);
+  CheckCandidateLimit(&walk, "car");
+
+  // Deletion index
+  TernaryTree index;
+  index.EnableDeletionIndex(2, 7);
+  index.SetMaxDifference(2);
+  for (auto w : words)
+    index.Insert(w);
+  CheckCandidateLimit(&index, "car");
+
+  // Long queries: one sharing a long prefix with a word before veering
+  // off, and one sharing nothing past its first character
+  std::string long_word;
+  while (long_word.length() < 200)
+    long_word += "abcdefghij";
+  std::string veers = long_word.substr(0, 199) + "!" + std::string(100, 'z');
+  std::string nothing = "c" + std::string(2000, 'q');
+  for (int levels : { 0, 2 }) {
+    TernaryTree tree;
+    tree.SetPathCompression(false);
+    tree.EnableRootTable(levels);
+    for (auto w : words)
+      tree.Insert(w);
+    tree.Insert(long_word.c_str());
+    CheckStemSearchCharged(&tree, veers.c_str());
+    CheckStemSearchCharged(&tree, nothing.c_str());
+  }
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,178 @@
+/* Dicto
+ * relayout_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include "dict_loader.h"
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// Tree features to build with
+struct Config {
+  int root_levels;
+  bool compress;
+  bool index;
+  double bloom_fp;
+};
+
+// Answers
+// Everything a tree says about a list of queries.
+struct Answers {
+  std::vector< bool > found;
+  std::vector< std::vector< std::string > > completions;
+  std::vector< std::map< int, std::string > > fuzzy;
+  bool operator==(const Answers &other) const {
+    return found == other.found && completions == other.completions &&
+      fuzzy == other.fuzzy;
+  }
+};
+
+// Build
+// Fill a tree with the words under the given features.
+//
+// @In:     config features
+//          words words to insert
+// @Out:    tree filled
+static void Build(
+    const Config &config,
+    const std::vector< std::string > &words,
+    TernaryTree *tree)
+{
+  tree->SetMaxDifference(2);
+  tree->SetPathCompression(config.compress);
+  if (config.root_levels)
+    tree->EnableRootTable(config.root_levels);
+  if (config.index)
+    tree->EnableDeletionIndex(2, 7);
+  for (auto &w : words)
+    tree->Insert(w.c_str());
+  if (config.bloom_fp > 0.0)
+    tree->EnableBloomFilter(config.bloom_fp);
+}
+
+// Ask
+// Run every query through Find, Complete and FuzzyFind.
+//
+// @In:     tree tree to ask
+//          queries lookups
+// @Out:    the answers
+static Answers Ask(TernaryTree *tree, const std::vector< std::string > &queries)
+{
+  Answers answers;
+  for (auto &q : queries) {
+    answers.found.push_back(tree->Find(q.c_str(), tree->GetRoot()));
+    std::vector< std::string > completions;
+    tree->Complete(q.c_str(), tree->GetRoot(), &completions, 20);
+    answers.completions.push_back(completions);
+    std::map< int, std::string > fuzzy;
+    tree->FuzzyFind(q.c_str(), tree->GetRoot(), &fuzzy);
+    answers.fuzzy.push_back(fuzzy);
+  }
+  return answers;
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+
+  // A slice of the dictionary, some words with capitals, and misspelled
+  // and partial queries
+  DictionaryLoader loader;
+  CHECK(loader.Load("res/dict.txt"));
+  std::vector< std::string > words;
+  for (size_t i = 0; i < loader.GetWordCount(); i += 50)
+    words.push_back(loader.GetWord(i));
+  words.push_back("Paris");
+  words.push_back("PARIS");
+  words.push_back("paris");
+  words.push_back("\xc3\x89t\xc3\xa9");
+  std::vector< std::string > late = { "zzyzx", "qwerty", "Paname", "aa" };
+  std::vector< std::string > queries = { "", "paris", "PaRiS", "\xc3\xa9t\xc3\xa9" };
+  uint32_t seed = 54321;
+  for (size_t i = 0; i < words.size(); i += 11) {
+    std::string q = words[ i ];
+    seed = seed * 1103515245 + 12345;
+    queries.push_back(q);
+    queries.push_back(q.substr(0, 1 + (seed >> 16) % q.length()));
+    q[ (seed >> 8) % q.length() ] = (char) ('a' + (seed >> 4) % 26);
+    queries.push_back(q);
+  }
+  for (auto &w : late)
+    queries.push_back(w);
+
+  const Config configs[] = {
+    { 0, true, false, 0.0 },
+    { 0, false, false, 0.0 },
+    { 2, true, false, 0.01 },
+    { 1, true, true, 0.0 },
+  };
+  for (auto &config : configs) {
+    TernaryTree original;
+    Build(config, words, &original);
+    Answers expected = Ask(&original, queries);
+    for (auto &w : late)
+      original.Insert(w.c_str());
+    Answers expected_late = Ask(&original, queries);
+
+    // Every layout and hot level count, laid out once and again, with
+    // heap nodes inserted between
+    for (LAYOUT layout : { LAYOUT_DFS, LAYOUT_VEB }) {
+      for (int hot : { 0, 3, TernaryTree::kHotLevels }) {
+        TernaryTree tree;
+        Build(config, words, &tree);
+        tree.Relayout(layout, hot);
+        CHECK(tree.GetArenaSize() == tree.GetNodeCount());
+        CHECK(Ask(&tree, queries) == expected);
+        for (auto &w : late)
+          tree.Insert(w.c_str());
+        CHECK(Ask(&tree, queries) == expected_late);
+        tree.Relayout(layout, hot);
+        CHECK(Ask(&tree, queries) == expected_late);
+      }
+    }
+
+    // Replicas: of a tree as inserted, of a laid out one, and of one with
+    // heap nodes past its arena
+    TernaryTree source;
+    Build(config, words, &source);
+    TernaryTree copy;
+    copy.CopyFrom(source);
+    CHECK(Ask(&copy, queries) == expected);
+    source.Relayout(LAYOUT_VEB);
+    TernaryTree laid_out_copy;
+    laid_out_copy.CopyFrom(source);
+    CHECK(Ask(&laid_out_copy, queries) == expected);
+    for (auto &w : late)
+      source.Insert(w.c_str());
+    TernaryTree mixed_copy;
+    mixed_copy.CopyFrom(source);
+    CHECK(Ask(&mixed_copy, queries) == expected_late);
+    CHECK(Ask(&source, queries) == expected_late);
+  }
+
+  return TEST_RESULT();
+}
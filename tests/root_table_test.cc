@@ -0,0 +1,118 @@
+/* Dicto
+ * root_table_test.cc
+ *
+ * Copyright (C) 2015 Gregory P. Hedger
+ * greg@hedgersoftware.com
+ * 30329 112th Pl. SE
+ * Auburn, WA 98092
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Also add information on how to contact you by electronic and paper mail.
+ *
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include "log.h"
+#include "ternary_tree.h"
+#include "test.h"
+
+// CheckLikePlain
+// A tree going through its root table must answer Find, Complete and
+// FuzzyFind exactly as a plain tree holding the same words.
+//
+// @In:     tree tree under test
+//          plain same words, no root table
+//          queries lookups to compare
+// @Out:    -
+static void CheckLikePlain(
+    TernaryTree *tree,
+    TernaryTree *plain,
+    const std::vector< std::string > &queries)
+{
+  for (auto &q : queries) {
+    CHECK_EQ(tree->Find(q.c_str(), tree->GetRoot()),
+      plain->Find(q.c_str(), plain->GetRoot()));
+
+    std::vector< std::string > got, expected;
+    tree->Complete(q.c_str(), tree->GetRoot(), &got, SIZE_MAX);
+    plain->Complete(q.c_str(), plain->GetRoot(), &expected, SIZE_MAX);
+    CHECK(got == expected);
+
+    std::map< int, std::string > fuzzy, fuzzy_plain;
+    tree->FuzzyFind(q.c_str(), tree->GetRoot(), &fuzzy);
+    plain->FuzzyFind(q.c_str(), plain->GetRoot(), &fuzzy_plain);
+    if (fuzzy != fuzzy_plain)
+      std::cerr << "levels " << tree->GetRootTableLevels() << ": FuzzyFind \""
+        << q << "\" differs" << std::endl;
+    CHECK(fuzzy == fuzzy_plain);
+  }
+}
+
+int main()
+{
+  SET_VERBOSITY_LEVEL(LOG_SILENT);
+
+  // Some words go in before the table is enabled, the rest after: new
+  // first characters, new second characters under a known first one,
+  // one-character words, and first bytes above 0x7f
+  std::vector< std::string > before = {
+    "cat", "car", "carton", "dog", "a", "ant", "zebra"
+  };
+  std::vector< std::string > after = {
+    "cab", "cot", "c", "x", "xi", "do", "dz", "b", "\xc3\xa9t\xc3\xa9", "\xc3\xa9", "ab"
+  };
+  std::vector< std::string > queries = {
+    "", "c", "ca", "cat", "cats", "co", "cb", "x", "xi", "xj", "y", "yy",
+    "d", "do", "dog", "dz", "dzz", "a", "an", "ab", "b", "bb", "z", "zebr",
+    "\xc3\xa9", "\xc3\xa9t", "\xc3\xa9t\xc3\xa9", "\xc3", "Cat", "AB"
+  };
+
+  for (int levels = 1; levels <= 2; levels++) {
+    TernaryTree tree;
+    TernaryTree plain;
+    tree.SetMaxDifference(2);
+    plain.SetMaxDifference(2);
+    for (auto &w : before) {
+      tree.Insert(w.c_str());
+      plain.Insert(w.c_str());
+    }
+    tree.EnableRootTable(levels);
+    CHECK_EQ(tree.GetRootTableLevels(), levels);
+    CheckLikePlain(&tree, &plain, queries);
+
+    for (auto &w : after) {
+      tree.Insert(w.c_str());
+      plain.Insert(w.c_str());
+    }
+    CheckLikePlain(&tree, &plain, queries);
+
+    // Relayout moves every node the tables point at; inserts after it
+    // add heap nodes under arena ones
+    tree.Relayout(LAYOUT_DFS);
+    plain.Relayout(LAYOUT_DFS);
+    CheckLikePlain(&tree, &plain, queries);
+    for (auto w : { "cb", "y", "yy", "ca" }) {
+      tree.Insert(w);
+      plain.Insert(w);
+    }
+    CheckLikePlain(&tree, &plain, queries);
+    tree.Relayout(LAYOUT_VEB);
+    CheckLikePlain(&tree, &plain, queries);
+  }
+
+  return TEST_RESULT();
+}